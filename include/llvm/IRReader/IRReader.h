@@ -15,16 +15,25 @@
 #ifndef LLVM_IRREADER_IRREADER_H
 #define LLVM_IRREADER_IRREADER_H
 
+#include "llvm/Support/ErrorOr.h"
 #include <memory>
 
 namespace llvm {
 
 class StringRef;
+class MemoryBuffer;
 class MemoryBufferRef;
 class Module;
 class SMDiagnostic;
 class LLVMContext;
 
+/// Read the given file, or stdin for "-", to be parsed as IR. Bitcode does
+/// not need a null terminator, so a bitcode file is always mapped into
+/// memory rather than read, and the bitcode reader refers to it in place.
+/// Assembly is returned null terminated, as the parser requires; the file is
+/// only read once, so it may be a pipe.
+ErrorOr<std::unique_ptr<MemoryBuffer>> getIRFileOrSTDIN(StringRef Filename);
+
 /// If the given file holds a bitcode image, return a Module
 /// for it which does lazy deserialization of function bodies.  Otherwise,
 /// attempt to parse it as LLVM Assembly and return a fully populated
@@ -416,6 +416,8 @@ void initializePNaClABIVerifyFunctionsPass(PassRegistry&);
 void initializePNaClABIVerifyModulePass(PassRegistry&);
 void initializePNaClSjLjEHPass(PassRegistry&);
 void initializePromoteI1OpsPass(PassRegistry&);
+void initializePromoteIntegerInstructionsPass(PassRegistry&);
+void initializePromoteIntegerSignaturesPass(PassRegistry&);
 void initializePromoteIntegersPass(PassRegistry&);
 void initializeRemoveAsmMemoryPass(PassRegistry&);
 void initializeRenameEntryPointPass(PassRegistry&);
@@ -442,6 +444,7 @@ void initializeLowerEmAsyncifyPass(PassRegistry&);
 void initializeLowerEmExceptionsPass(PassRegistry&);
 void initializeLowerEmSetjmpPass(PassRegistry&);
 void initializeLowerNonEmIntrinsicsPass(PassRegistry&);
+void initializeNarrowI64Pass(PassRegistry&);
 void initializeNoExitRuntimePass(PassRegistry&);
 // Emscripten passes end.
 // @LOCALMOD-END
@@ -38,6 +38,7 @@ FunctionPass *createExpandLargeIntegersPass();
 FunctionPass *createExpandStructRegsPass();
 FunctionPass *createInsertDivideCheckPass();
 FunctionPass *createNormalizeAlignmentPass();
+FunctionPass *createPromoteIntegerInstructionsPass();
 FunctionPass *createRemoveAsmMemoryPass();
 FunctionPass *createResolvePNaClIntrinsicsPass();
 ModulePass *createAddPNaClExternalDeclsPass();
@@ -56,6 +57,7 @@ ModulePass *createGlobalCleanupPass();
 ModulePass *createGlobalizeConstantVectorsPass();
 ModulePass *createInternalizeUsedGlobalsPass();
 ModulePass *createPNaClSjLjEHPass();
+ModulePass *createPromoteIntegerSignaturesPass();
 ModulePass *createPromoteIntegersPass();
 ModulePass *createReplacePtrsWithIntsPass();
 ModulePass *createResolveAliasesPass();
@@ -75,6 +77,7 @@ ModulePass *createLowerEmAsyncifyPass();
 ModulePass *createLowerEmExceptionsPass();
 ModulePass *createLowerEmSetjmpPass();
 ModulePass *createLowerNonEmIntrinsicsPass();
+FunctionPass *createNarrowI64Pass();
 ModulePass *createNoExitRuntimePass();
 // Emscripten passes end.
 
@@ -67,6 +67,7 @@
 #include "llvm/Support/MathExtras.h"
 #include "llvm/Support/SHA1.h"
 #include "llvm/Support/TargetRegistry.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/raw_ostream.h"
 #include <algorithm>
 #include <cassert>
@@ -86,6 +87,11 @@ static cl::opt<unsigned>
                    cl::desc("Number of metadatas above which we emit an index "
                             "to enable lazy-loading"));
 
+static cl::opt<unsigned> WriterThreads(
+    "bitcode-writer-threads", cl::Hidden, cl::init(0),
+    cl::desc("Number of threads to encode function blocks on; the output "
+             "is the same as with one (0 or 1 writes them on this thread)"));
+
 namespace {
 
 /// These are manifest constants used by the bitcode writer. They do not need to
@@ -114,6 +120,9 @@ enum {
   FUNCTION_INST_GEP_ABBREV,
 };
 
+/// The abbrev width of FUNCTION_BLOCKs.
+const unsigned FunctionBlockCodeLen = 4;
+
 /// Abstract class to manage the bitcode writing, subclassed for each bitcode
 /// file type.
 class BitcodeWriterBase {
@@ -375,6 +384,12 @@ private:
   void
   writeFunction(const Function &F,
                 DenseMap<const Function *, uint64_t> &FunctionToBitcodeIndex);
+  void writeFunctionsInParallel(
+      DenseMap<const Function *, uint64_t> &FunctionToBitcodeIndex);
+  void
+  writeFunctionBlocks(ArrayRef<const Function *> Functions,
+                      const DenseMap<const Function *, unsigned> &Positions,
+                      std::vector<size_t> &Offsets);
   void writeBlockInfo();
   void writeModuleHash(size_t BlockStartPos);
 
@@ -2995,7 +3010,7 @@ void ModuleBitcodeWriter::writeFunction(
   // in the VST.
   FunctionToBitcodeIndex[&F] = Stream.GetCurrentBitNo();
 
-  Stream.EnterSubblock(bitc::FUNCTION_BLOCK_ID, 4);
+  Stream.EnterSubblock(bitc::FUNCTION_BLOCK_ID, FunctionBlockCodeLen);
   VE.incorporateFunction(F);
 
   SmallVector<unsigned, 64> Vals;
@@ -3065,6 +3080,110 @@ void ModuleBitcodeWriter::writeFunction(
   Stream.ExitBlock();
 }
 
+/// Encode the blocks of Functions, which are consecutive function definitions
+/// of the module, into this writer's stream, one after the other. This writer
+/// is private to one thread of writeFunctionsInParallel, and its value
+/// enumerator numbers everything as the main writer's does. Offsets receives
+/// where each block starts in the buffer, past its header, that is where its
+/// size word is.
+void ModuleBitcodeWriter::writeFunctionBlocks(
+    ArrayRef<const Function *> Functions,
+    const DenseMap<const Function *, unsigned> &Positions,
+    std::vector<size_t> &Offsets) {
+  // Function blocks use the abbreviations defined in the blockinfo block.
+  writeBlockInfo();
+
+  DenseMap<const Function *, uint64_t> FunctionToBitcodeIndex;
+  for (const Function *F : Functions) {
+    // Skip the use-list orders of the module and of the functions before F,
+    // which other writers emit.
+    if (VE.shouldPreserveUseListOrder()) {
+      unsigned Position = Positions.lookup(F);
+      while (!VE.UseListOrders.empty()) {
+        const Function *Owner = VE.UseListOrders.back().F;
+        if (Owner && Positions.lookup(Owner) >= Position)
+          break;
+        VE.UseListOrders.pop_back();
+      }
+    }
+
+    // The stream is at the top level and word aligned here, so the block
+    // header, ENTER_SUBBLOCK and its operands, takes exactly one word.
+    size_t Start = Buffer.size();
+    writeFunction(*F, FunctionToBitcodeIndex);
+    assert(support::endian::read32le(&Buffer[Start + 4]) * 4 ==
+               Buffer.size() - Start - 8 &&
+           "Unexpected function block header");
+    Offsets.push_back(Start + 4);
+  }
+}
+
+/// Write the function blocks as writeFunction would, but encode them on
+/// WriterThreads threads. The function definitions are split into as many
+/// runs of consecutive functions, and each run is encoded by a writer of its
+/// own into a separate buffer. The blocks are then copied into the stream in
+/// order, behind a block header written here, so that the output is the same
+/// bit for bit. Encoding a block after the header that it would follow in
+/// the stream gives the same bits, since a block starts word aligned.
+void ModuleBitcodeWriter::writeFunctionsInParallel(
+    DenseMap<const Function *, uint64_t> &FunctionToBitcodeIndex) {
+  std::vector<const Function *> Functions;
+  DenseMap<const Function *, unsigned> Positions;
+  for (const Function &F : M) {
+    if (F.isDeclaration())
+      continue;
+    Positions[&F] = Functions.size();
+    Functions.push_back(&F);
+  }
+
+  struct Run {
+    SmallVector<char, 0> Buffer;
+    std::vector<size_t> Offsets;
+  };
+  unsigned NumRuns = std::min<size_t>(WriterThreads, Functions.size());
+  std::vector<Run> Runs(NumRuns);
+  auto RunBegin = [&](unsigned I) { return Functions.size() * I / NumRuns; };
+  {
+    ThreadPool Pool(NumRuns);
+    for (unsigned I = 0; I < NumRuns; ++I)
+      Pool.async([&, I]() {
+        BitstreamWriter RunStream(Runs[I].Buffer);
+        StringTableBuilder RunStrtab(StringTableBuilder::RAW);
+        ModuleBitcodeWriter Writer(&M, Runs[I].Buffer, RunStrtab, RunStream,
+                                   VE.shouldPreserveUseListOrder(), nullptr,
+                                   /*GenerateHash=*/false);
+        size_t Begin = RunBegin(I);
+        Writer.writeFunctionBlocks(
+            makeArrayRef(Functions).slice(Begin, RunBegin(I + 1) - Begin),
+            Positions, Runs[I].Offsets);
+      });
+    Pool.wait();
+  }
+
+  unsigned Next = 0;
+  for (Run &R : Runs) {
+    for (size_t Begin : R.Offsets) {
+      FunctionToBitcodeIndex[Functions[Next++]] = Stream.GetCurrentBitNo();
+      // The header EnterSubblock writes, up to the block size word.
+      Stream.EmitCode(bitc::ENTER_SUBBLOCK);
+      Stream.EmitVBR(bitc::FUNCTION_BLOCK_ID, bitc::BlockIDWidth);
+      Stream.EmitVBR(FunctionBlockCodeLen, bitc::CodeLenWidth);
+      Stream.FlushToWord();
+      // The size word, then the body and END_BLOCK it counts.
+      size_t End = Begin + 4 + support::endian::read32le(&R.Buffer[Begin]) * 4;
+      for (size_t Pos = Begin; Pos < End; Pos += 4)
+        Stream.Emit(support::endian::read32le(&R.Buffer[Pos]), 32);
+    }
+    // Free each run once it has been copied.
+    R = Run();
+  }
+
+  // The use-list orders of the functions were emitted by the other writers.
+  if (VE.shouldPreserveUseListOrder())
+    while (!VE.UseListOrders.empty() && VE.UseListOrders.back().F)
+      VE.UseListOrders.pop_back();
+}
+
 // Emit blockinfo, which defines the standard abbreviations etc.
 void ModuleBitcodeWriter::writeBlockInfo() {
   // We only want to emit block info records for blocks that have multiple
@@ -3849,9 +3968,12 @@ void ModuleBitcodeWriter::write() {
 
   // Emit function bodies.
   DenseMap<const Function *, uint64_t> FunctionToBitcodeIndex;
-  for (Module::const_iterator F = M.begin(), E = M.end(); F != E; ++F)
-    if (!F->isDeclaration())
-      writeFunction(*F, FunctionToBitcodeIndex);
+  if (WriterThreads > 1)
+    writeFunctionsInParallel(FunctionToBitcodeIndex);
+  else
+    for (Module::const_iterator F = M.begin(), E = M.end(); F != E; ++F)
+      if (!F->isDeclaration())
+        writeFunction(*F, FunctionToBitcodeIndex);
 
   // Need to write after the above call to WriteFunction which populates
   // the summary information in the index.
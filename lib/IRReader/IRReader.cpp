@@ -14,6 +14,7 @@
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Process.h"
 #include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/Timer.h"
 #include "llvm/Support/raw_ostream.h"
@@ -50,12 +51,36 @@ getLazyIRModule(std::unique_ptr<MemoryBuffer> Buffer, SMDiagnostic &Err,
   return parseAssembly(Buffer->getMemBufferRef(), Err, Context);
 }
 
+ErrorOr<std::unique_ptr<MemoryBuffer>>
+llvm::getIRFileOrSTDIN(StringRef Filename) {
+  // Without a null terminator the file can be mapped whatever its size, since
+  // no zero byte has to follow it. Standard input is read into a null
+  // terminated copy anyway.
+  ErrorOr<std::unique_ptr<MemoryBuffer>> FileOrErr =
+      MemoryBuffer::getFileOrSTDIN(Filename, -1,
+                                   /*RequiresNullTerminator=*/false);
+  if (!FileOrErr)
+    return FileOrErr;
+  MemoryBuffer &Buffer = **FileOrErr;
+  if (isBitcode((const unsigned char *)Buffer.getBufferStart(),
+                (const unsigned char *)Buffer.getBufferEnd()))
+    return FileOrErr;
+  // A file that was read rather than mapped (a small file, a pipe, or standard
+  // input) is always followed by a null byte, and so is a mapped file that
+  // ends within its last page, which the system fills with zeros. Only a
+  // mapped file that ends on a page boundary has to be copied for the parser.
+  if (Buffer.getBufferKind() == MemoryBuffer::MemoryBuffer_Malloc ||
+      Buffer.getBufferSize() % sys::Process::getPageSize() != 0)
+    return FileOrErr;
+  return MemoryBuffer::getMemBufferCopy(Buffer.getBuffer(),
+                                        Buffer.getBufferIdentifier());
+}
+
 std::unique_ptr<Module> llvm::getLazyIRFileModule(StringRef Filename,
                                                   SMDiagnostic &Err,
                                                   LLVMContext &Context,
                                                   bool ShouldLazyLoadMetadata) {
-  ErrorOr<std::unique_ptr<MemoryBuffer>> FileOrErr =
-      MemoryBuffer::getFileOrSTDIN(Filename);
+  ErrorOr<std::unique_ptr<MemoryBuffer>> FileOrErr = getIRFileOrSTDIN(Filename);
   if (std::error_code EC = FileOrErr.getError()) {
     Err = SMDiagnostic(Filename, SourceMgr::DK_Error,
                        "Could not open input file: " + EC.message());
@@ -92,8 +117,7 @@ std::unique_ptr<Module> llvm::parseIR(MemoryBufferRef Buffer, SMDiagnostic &Err,
 std::unique_ptr<Module> llvm::parseIRFile(StringRef Filename, SMDiagnostic &Err,
                                           LLVMContext &Context,
                                           bool UpgradeDebugInfo) {
-  ErrorOr<std::unique_ptr<MemoryBuffer>> FileOrErr =
-      MemoryBuffer::getFileOrSTDIN(Filename);
+  ErrorOr<std::unique_ptr<MemoryBuffer>> FileOrErr = getIRFileOrSTDIN(Filename);
   if (std::error_code EC = FileOrErr.getError()) {
     Err = SMDiagnostic(Filename, SourceMgr::DK_Error,
                        "Could not open input file: " + EC.message());
@@ -15,8 +15,10 @@
 #include "llvm/ADT/ArrayRef.h"
 #include "llvm/ADT/StringRef.h"
 #include "llvm/BinaryFormat/Magic.h"
+#include "llvm/Bitcode/BitcodeReader.h"
 #include "llvm/IR/LLVMContext.h"
 #include "llvm/Object/Archive.h"
+#include "llvm/Object/IRSymtab.h"
 #include "llvm/Object/ObjectFile.h"
 #include "llvm/Object/SymbolicFile.h"
 #include "llvm/Support/EndianStream.h"
@@ -381,9 +383,45 @@ static void writeSymbolTable(raw_ostream &Out, object::Archive::Kind Kind,
     Out.write(uint8_t(0));
 }
 
+// Reads the symbols of a bitcode member from the irsymtab it carries, which
+// avoids loading any IR. Returns false if there is no usable irsymtab.
+static bool getBitcodeSymbols(MemoryBufferRef Buf, raw_ostream &SymNames,
+                              std::vector<unsigned> &Ret) {
+  Expected<BitcodeFileContents> BFCOrErr = getBitcodeFileContents(Buf);
+  if (!BFCOrErr) {
+    consumeError(BFCOrErr.takeError());
+    return false;
+  }
+  Expected<irsymtab::FileContents> FCOrErr = irsymtab::readBitcode(*BFCOrErr);
+  if (!FCOrErr) {
+    consumeError(FCOrErr.takeError());
+    return false;
+  }
+  for (const irsymtab::Symbol &Sym : FCOrErr->TheReader.symbols()) {
+    // The same symbols isArchiveSymbol picks from an IRObjectFile.
+    if (Sym.isFormatSpecific() || !Sym.isGlobal() ||
+        (Sym.isUndefined() && !Sym.isIndirect()))
+      continue;
+    Ret.push_back(SymNames.tell());
+    SymNames << Sym.getName() << '\0';
+  }
+  return true;
+}
+
 static Expected<std::vector<unsigned>>
 getSymbols(MemoryBufferRef Buf, raw_ostream &SymNames, bool &HasObject) {
   std::vector<unsigned> Ret;
+
+  if (identify_magic(Buf.getBuffer()) == file_magic::bitcode) {
+    uint64_t Start = SymNames.tell();
+    if (getBitcodeSymbols(Buf, SymNames, Ret)) {
+      HasObject = true;
+      return Ret;
+    }
+    assert(SymNames.tell() == Start && Ret.empty());
+    (void)Start;
+  }
+
   LLVMContext Context;
 
   Expected<std::unique_ptr<object::SymbolicFile>> ObjOrErr =
@@ -10,9 +10,14 @@
 #include "llvm/Support/ScopedPrinter.h"
 
 typedef std::string (JSWriter::*CallHandler)(const Instruction*, std::string Name, int NumArgs);
-typedef std::map<std::string, CallHandler> CallHandlerMap;
+typedef llvm::StringMap<CallHandler> CallHandlerMap;
 CallHandlerMap CallHandlers;
 
+// Handlers already resolved for direct callees, so that each call does not
+// need to look up the callee's name.
+typedef DenseMap<const Function*, CallHandler> FunctionCallHandlerMap;
+FunctionCallHandlerMap FunctionCallHandlers;
+
 // Definitions
 
 unsigned getNumArgOperands(const Instruction *I) {
@@ -104,7 +109,12 @@ DEF_CALL_HANDLER(__default__, {
       ensureFunctionTable(FT);
       if (!Invoke) {
         Sig = getFunctionSignature(FT);
-        if (!EmulatedFunctionPointers) {
+        auto Only = OnlyTableTargets.find(Sig);
+        if (Only != OnlyTableTargets.end()) {
+          // devirtualize: only one function can be called through this table
+          Name = getJSName(Only->second);
+          NeedCasts = false;
+        } else if (!EmulatedFunctionPointers) {
           Name = std::string("FUNCTION_TABLE_") + Sig + '[' + Name + " & #FM_" + Sig + "#]";
           NeedCasts = false; // function table call, so stays in asm module
         } else {
@@ -387,14 +397,14 @@ DEF_CALL_HANDLER(llvm_nacl_atomic_store_i32, {
   return "HEAP32[" + getValueAsStr(CI->getOperand(0)) + ">>2]=" + getValueAsStr(CI->getOperand(1));
 })
 
-#define CMPXCHG_HANDLER(name, HeapName) \
+#define CMPXCHG_HANDLER(name, HeapName, Bytes) \
 DEF_CALL_HANDLER(name, { \
   if (!strcmp(HeapName, "HEAP8")) UsesInt8Array = true; \
   else if (!strcmp(HeapName, "HEAP16")) UsesInt16Array = true; \
   else if (!strcmp(HeapName, "HEAP32")) UsesInt32Array = true; \
   const Value *P = CI->getOperand(0); \
   if (EnablePthreads) { \
-    return getAssign(CI) + "(Atomics_compareExchange(" HeapName ", " + getShiftedPtr(CI->getOperand(0), 4) + ',' + getValueAsStr(CI->getOperand(1)) + ',' + getValueAsStr(CI->getOperand(2)) + ")|0)"; \
+    return getAssign(CI) + "(Atomics_compareExchange(" HeapName ", " + getShiftedPtr(CI->getOperand(0), Bytes) + ',' + getValueAsStr(CI->getOperand(1)) + ',' + getValueAsStr(CI->getOperand(2)) + ")|0)"; \
   } else { \
     return getLoad(CI, P, CI->getType(), 0) + ';' + \
              "if ((" + getCast(getJSName(CI), CI->getType()) + ") == " + getValueAsCastParenStr(CI->getOperand(1)) + ") " + \
@@ -402,12 +412,21 @@ DEF_CALL_HANDLER(name, { \
   } \
 })
 
-CMPXCHG_HANDLER(llvm_nacl_atomic_cmpxchg_i8, "HEAP8");
-CMPXCHG_HANDLER(llvm_nacl_atomic_cmpxchg_i16, "HEAP16");
-CMPXCHG_HANDLER(llvm_nacl_atomic_cmpxchg_i32, "HEAP32");
+CMPXCHG_HANDLER(llvm_nacl_atomic_cmpxchg_i8, "HEAP8", 1);
+CMPXCHG_HANDLER(llvm_nacl_atomic_cmpxchg_i16, "HEAP16", 2);
+CMPXCHG_HANDLER(llvm_nacl_atomic_cmpxchg_i32, "HEAP32", 4);
 
-#define UNROLL_LOOP_MAX 8
-#define WRITE_LOOP_MAX 128
+// i64 is only legal in wasm-only mode (otherwise ExpandI64 rejects 64-bit cmpxchg)
+DEF_CALL_HANDLER(llvm_nacl_atomic_cmpxchg_i64, {
+  const Value *P = CI->getOperand(0);
+  if (EnablePthreads) {
+    return getAssign(CI) + "(i64_atomics_compareExchange(" + getValueAsStr(P) + ',' + getValueAsStr(CI->getOperand(1)) + ',' + getValueAsStr(CI->getOperand(2)) + ")|0)";
+  } else {
+    return getLoad(CI, P, CI->getType(), 0) + ';' +
+             "if (i64_eq(" + getJSName(CI) + ',' + getValueAsStr(CI->getOperand(1)) + ")) " +
+                getStore(CI, P, CI->getType(), getValueAsStr(CI->getOperand(2)), 0);
+  }
+})
 
 DEF_CALL_HANDLER(llvm_memcpy_p0i8_p0i8_i32, {
   if (CI) {
@@ -417,7 +436,7 @@ DEF_CALL_HANDLER(llvm_memcpy_p0i8_p0i8_i32, {
       if (LenInt) {
         // we can emit inline code for this
         unsigned Len = LenInt->getZExtValue();
-        if (Len <= WRITE_LOOP_MAX) {
+        if (Len <= MemOpInlineMax) {
           unsigned Align = AlignInt->getZExtValue();
           if (OnlyWebAssembly) {
             // wasm
@@ -458,7 +477,7 @@ DEF_CALL_HANDLER(llvm_memcpy_p0i8_p0i8_i32, {
               // handle as much as we can in the current alignment
               unsigned CurrLen = Align*(Len/Align);
               unsigned Factor = CurrLen/Align;
-              if (Factor <= UNROLL_LOOP_MAX) {
+              if (Factor <= MemOpUnrollMax) {
                 // unroll
                 for (unsigned Offset = 0; Offset < CurrLen; Offset += Align) {
                   unsigned PosOffset = Pos + Offset;
@@ -495,7 +514,7 @@ DEF_CALL_HANDLER(llvm_memset_p0i8_i32, {
         if (ValInt) {
           // we can emit inline code for this
           unsigned Len = LenInt->getZExtValue();
-          if (Len <= WRITE_LOOP_MAX) {
+          if (Len <= MemOpInlineMax) {
             unsigned Align = AlignInt->getZExtValue();
             if (OnlyWebAssembly) {
               // wasm
@@ -546,7 +565,7 @@ DEF_CALL_HANDLER(llvm_memset_p0i8_i32, {
                   FullVal |= Val;
                 }
                 unsigned Factor = CurrLen/Align;
-                if (Factor <= UNROLL_LOOP_MAX) {
+                if (Factor <= MemOpUnrollMax) {
                   // unroll
                   for (unsigned Offset = 0; Offset < CurrLen; Offset += Align) {
                     unsigned PosOffset = Pos + Offset;
@@ -575,6 +594,42 @@ DEF_CALL_HANDLER(llvm_memset_p0i8_i32, {
 })
 
 DEF_CALL_HANDLER(llvm_memmove_p0i8_p0i8_i32, {
+  if (CI) {
+    ConstantInt *AlignInt = dyn_cast<ConstantInt>(CI->getOperand(3));
+    ConstantInt *LenInt = dyn_cast<ConstantInt>(CI->getOperand(2));
+    if (AlignInt && LenInt) {
+      unsigned Len = LenInt->getZExtValue();
+      unsigned Align = AlignInt->getZExtValue();
+      if (Align > 4) Align = 4;
+      else if (Align == 0) Align = 1; // align 0 means 1 in memcpy and memset (unlike other places where it means 'default/4')
+      unsigned NumAccesses = 0;
+      for (unsigned L = Len, A = Align; L > 0; A /= 2) {
+        NumAccesses += L/A;
+        L %= A;
+      }
+      if (NumAccesses <= MemOpUnrollMax) {
+        // we can emit inline code for this. the source and destination may
+        // overlap, so load everything into temps before storing any of it
+        unsigned Pos = 0;
+        unsigned Temp = 0;
+        std::string Loads;
+        std::string Stores;
+        std::string Dest = getValueAsStr(CI->getOperand(0));
+        std::string Src = getValueAsStr(CI->getOperand(1));
+        while (Len > 0) {
+          for (; Len >= Align; Len -= Align, Pos += Align) {
+            std::string Add = Pos == 0 ? "" : ('+' + utostr(Pos));
+            std::string Var = "move" + utostr(Temp++);
+            UsedVars[Var] = Type::getInt32Ty(TheModule->getContext());
+            Loads += ';' + Var + '=' + getHeapAccess(Src + Add, Align) + "|0";
+            Stores += ';' + getHeapAccess(Dest + Add, Align) + '=' + Var;
+          }
+          Align /= 2;
+        }
+        return Loads + Stores;
+      }
+    }
+  }
   Declares.insert("memmove");
   return CH___default__(CI, "_memmove", 3) + "|0";
 })
@@ -880,6 +935,14 @@ DEF_CALL_HANDLER(emscripten_atomic_cas_u32, {
   return getAssign(CI) + "(Atomics_compareExchange(HEAP32, " + getShiftedPtr(CI->getOperand(0), 4) + ',' + getValueAsStr(CI->getOperand(1)) + ',' + getValueAsStr(CI->getOperand(2)) + ")|0)";
 })
 
+DEF_CALL_HANDLER(emscripten_atomic_cas_u64, {
+  if (CI && OnlyWebAssembly) {
+    return getAssign(CI) + "(i64_atomics_compareExchange(" + getValueAsStr(CI->getOperand(0)) + ',' + getValueAsStr(CI->getOperand(1)) + ',' + getValueAsStr(CI->getOperand(2)) + ")|0)";
+  }
+  Declares.insert("emscripten_atomic_cas_u64");
+  return CH___default__(CI, "_emscripten_atomic_cas_u64");
+})
+
 DEF_CALL_HANDLER(emscripten_atomic_load_u8, {
   UsesInt8Array = true;
   if (!CI) return ""; // we are just called from a handler that was called from getFunctionIndex, only to ensure the handler was run at least once
@@ -896,6 +959,11 @@ DEF_CALL_HANDLER(emscripten_atomic_load_u32, {
   return getAssign(CI) + "(Atomics_load(HEAP32, " + getShiftedPtr(CI->getOperand(0), 4) + ")|0)";
 })
 DEF_CALL_HANDLER(emscripten_atomic_load_f32, {
+  if (CI && OnlyWebAssembly) {
+    // wasm can reinterpret the bits of an integer atomic
+    UsesInt32Array = true;
+    return getAssign(CI) + "i32_bc2f(Atomics_load(HEAP32, " + getShiftedPtr(CI->getOperand(0), 4) + ")|0)";
+  }
   // TODO: If https://bugzilla.mozilla.org/show_bug.cgi?id=1131613 is implemented, we could use the commented out version. Until then,
   // we must emulate manually.
   Declares.insert("_Atomics_load_f32_emulated");
@@ -905,6 +973,10 @@ DEF_CALL_HANDLER(emscripten_atomic_load_f32, {
 //  return getAssign(CI) + "Atomics_load(HEAPF32, " + getShiftedPtr(CI->getOperand(0), 4) + ')';
 })
 DEF_CALL_HANDLER(emscripten_atomic_load_f64, {
+  if (CI && OnlyWebAssembly) {
+    // wasm can reinterpret the bits of an integer atomic
+    return getAssign(CI) + "i64_bc2d(i64_atomics_load(" + getValueAsStr(CI->getOperand(0)) + "))";
+  }
   // TODO: If https://bugzilla.mozilla.org/show_bug.cgi?id=1131624 is implemented, we could use the commented out version. Until then,
   // we must emulate manually.
   Declares.insert("emscripten_atomic_load_f64");
@@ -937,6 +1009,14 @@ DEF_CALL_HANDLER(emscripten_atomic_store_u32, {
   return getAssign(CI) + "(Atomics_store(HEAP32, " + getShiftedPtr(CI->getOperand(0), 4) + ',' + getValueAsStr(CI->getOperand(1)) + ")|0)";
 })
 DEF_CALL_HANDLER(emscripten_atomic_store_f32, {
+  if (CI && OnlyWebAssembly) {
+    // wasm can reinterpret the bits of an integer atomic; the call returns the stored value
+    UsesInt32Array = true;
+    std::string V = getValueAsStr(CI->getOperand(1));
+    std::string Store = "Atomics_store(HEAP32, " + getShiftedPtr(CI->getOperand(0), 4) + ", i32_bc2i(" + V + "))|0";
+    if (CI->use_empty()) return Store;
+    return Store + "; " + getAssignIfNeeded(CI) + V;
+  }
   // TODO: If https://bugzilla.mozilla.org/show_bug.cgi?id=1131613 is implemented, we could use the commented out version. Until then,
   // we must emulate manually.
   Declares.insert("emscripten_atomic_store_f32");
@@ -945,6 +1025,13 @@ DEF_CALL_HANDLER(emscripten_atomic_store_f32, {
 //  return getAssign(CI) + "Atomics_store(HEAPF32, " + getShiftedPtr(CI->getOperand(0), 4) + ',' + getValueAsStr(CI->getOperand(1)) + ')';
 })
 DEF_CALL_HANDLER(emscripten_atomic_store_f64, {
+  if (CI && OnlyWebAssembly) {
+    // wasm can reinterpret the bits of an integer atomic; the call returns the stored value
+    std::string V = getValueAsStr(CI->getOperand(1));
+    std::string Store = "i64_atomics_store(" + getValueAsStr(CI->getOperand(0)) + ", i64_bc2i(" + V + "))|0";
+    if (CI->use_empty()) return Store;
+    return Store + "; " + getAssignIfNeeded(CI) + V;
+  }
   // TODO: If https://bugzilla.mozilla.org/show_bug.cgi?id=1131624 is implemented, we could use the commented out version. Until then,
   // we must emulate manually.
   Declares.insert("emscripten_atomic_store_f64");
@@ -1897,6 +1984,7 @@ void setupCallHandlers() {
   SETUP_CALL_HANDLER(llvm_nacl_atomic_cmpxchg_i8);
   SETUP_CALL_HANDLER(llvm_nacl_atomic_cmpxchg_i16);
   SETUP_CALL_HANDLER(llvm_nacl_atomic_cmpxchg_i32);
+  SETUP_CALL_HANDLER(llvm_nacl_atomic_cmpxchg_i64);
   SETUP_CALL_HANDLER(llvm_memcpy_p0i8_p0i8_i32);
   SETUP_CALL_HANDLER(llvm_memset_p0i8_i32);
   SETUP_CALL_HANDLER(llvm_memmove_p0i8_p0i8_i32);
@@ -2370,6 +2458,7 @@ void setupCallHandlers() {
   SETUP_CALL_HANDLER(emscripten_atomic_cas_u8);
   SETUP_CALL_HANDLER(emscripten_atomic_cas_u16);
   SETUP_CALL_HANDLER(emscripten_atomic_cas_u32);
+  SETUP_CALL_HANDLER(emscripten_atomic_cas_u64);
 
   SETUP_CALL_HANDLER(emscripten_atomic_load_u8);
   SETUP_CALL_HANDLER(emscripten_atomic_load_u16);
@@ -2504,10 +2593,14 @@ std::string handleCall(const Instruction *CI) {
   // we don't need to use a function index.
   const std::string &Name = isa<Function>(CV) ? getJSName(CV) : getValueAsStr(CV);
 
-  CallHandlerMap::iterator CH = CallHandlers.find("___default__");
-  if (isa<Function>(CV)) {
-    CallHandlerMap::iterator Custom = CallHandlers.find(Name);
-    if (Custom != CallHandlers.end()) CH = Custom;
+  CallHandler CH = &JSWriter::CH___default__;
+  if (const Function *F = dyn_cast<Function>(CV)) {
+    CallHandler &Cached = FunctionCallHandlers[F];
+    if (!Cached) {
+      CallHandlerMap::iterator Custom = CallHandlers.find(Name);
+      Cached = Custom != CallHandlers.end() ? Custom->second : CH;
+    }
+    CH = Cached;
   }
-  return (this->*(CH->second))(CI, Name, -1);
+  return (this->*CH)(CI, Name, -1);
 }
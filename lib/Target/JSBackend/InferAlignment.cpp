@@ -0,0 +1,129 @@
+//===-- InferAlignment.cpp - Raise memory access alignment ------*- C++ -*-===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===-----------------------------------------------------------------------===//
+//
+// Loads and stores that are less aligned than their size are emitted as a
+// series of smaller heap accesses, so it is worth proving that the pointer
+// is in fact aligned. This raises the alignment of loads, stores and memory
+// intrinsics to what can be proven about their pointers: alignment of
+// allocas and globals, constant offsets from them, and llvm.assume. It must
+// run before RemoveLLVMAssume.
+//
+//===-----------------------------------------------------------------------===//
+
+#include "OptPasses.h"
+
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/AssumptionCache.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/Module.h"
+#include "llvm/InitializePasses.h"
+#include "llvm/Transforms/Utils/Local.h"
+
+#define DEBUG_TYPE "emscripten-infer-alignment"
+
+STATISTIC(NumRaised, "Number of memory accesses with raised alignment");
+STATISTIC(NumMadeAligned, "Number of unaligned loads and stores that became aligned");
+
+namespace llvm {
+
+// Memory intrinsics are emitted in chunks of at most this size, so there is
+// nothing to gain from proving more alignment for them.
+static const unsigned MaxMemIntrinsicAlignment = 8;
+
+struct InferAlignment : public FunctionPass {
+  static char ID; // Pass identification, replacement for typeid
+  InferAlignment() : FunctionPass(ID) {
+    initializeAssumptionCacheTrackerPass(*PassRegistry::getPassRegistry());
+    initializeDominatorTreeWrapperPassPass(*PassRegistry::getPassRegistry());
+  }
+
+  bool runOnFunction(Function &Func) override;
+
+  void getAnalysisUsage(AnalysisUsage &AU) const override {
+    AU.addRequired<AssumptionCacheTracker>();
+    AU.addRequired<DominatorTreeWrapperPass>();
+    AU.setPreservesCFG();
+  }
+
+  StringRef getPassName() const override { return "InferAlignment"; }
+
+private:
+  AssumptionCache *AC;
+  DominatorTree *DT;
+  const DataLayout *DL;
+
+  // Returns the alignment Ptr is known to have at I, but no more than Max.
+  unsigned getAlignment(Value *Ptr, Instruction *I, unsigned Max) {
+    return std::min(getKnownAlignment(Ptr, *DL, I, AC, DT), Max);
+  }
+
+  template<typename T> bool raiseAlignment(T *I);
+  bool raiseAlignment(MemIntrinsic *MI);
+};
+
+char InferAlignment::ID = 0;
+
+// Raises the alignment of a load or store up to the size of the access,
+// which is all that matters for emitting it as one heap access. An
+// alignment of 0 means the ABI alignment, which is never unaligned here.
+template<typename T> bool InferAlignment::raiseAlignment(T *I) {
+  unsigned Alignment = I->getAlignment();
+  if (Alignment == 0) return false;
+  unsigned Bytes = DL->getTypeAllocSize(I->getPointerOperand()->getType()->getPointerElementType());
+  if (Alignment >= Bytes) return false;
+  unsigned Known = getAlignment(I->getPointerOperand(), I, Bytes);
+  if (Known <= Alignment) return false;
+  I->setAlignment(Known);
+  NumRaised++;
+  if (Known >= Bytes) NumMadeAligned++;
+  return true;
+}
+
+bool InferAlignment::raiseAlignment(MemIntrinsic *MI) {
+  unsigned Alignment = MI->getAlignment();
+  if (Alignment == 0 || Alignment >= MaxMemIntrinsicAlignment) return false;
+  unsigned Known = getAlignment(MI->getRawDest(), MI, MaxMemIntrinsicAlignment);
+  if (MemTransferInst *MTI = dyn_cast<MemTransferInst>(MI)) {
+    Known = std::min(Known, getAlignment(MTI->getRawSource(), MI, MaxMemIntrinsicAlignment));
+  }
+  if (Known <= Alignment) return false;
+  MI->setAlignment(ConstantInt::get(MI->getAlignmentType(), Known));
+  NumRaised++;
+  return true;
+}
+
+bool InferAlignment::runOnFunction(Function &Func) {
+  AC = &getAnalysis<AssumptionCacheTracker>().getAssumptionCache(Func);
+  DT = &getAnalysis<DominatorTreeWrapperPass>().getDomTree();
+  DL = &Func.getParent()->getDataLayout();
+
+  bool Changed = false;
+  for (Instruction &I : instructions(Func)) {
+    if (LoadInst *LI = dyn_cast<LoadInst>(&I)) {
+      Changed |= raiseAlignment(LI);
+    } else if (StoreInst *SI = dyn_cast<StoreInst>(&I)) {
+      Changed |= raiseAlignment(SI);
+    } else if (MemIntrinsic *MI = dyn_cast<MemIntrinsic>(&I)) {
+      Changed |= raiseAlignment(MI);
+    }
+  }
+  return Changed;
+}
+
+//
+
+extern FunctionPass *createEmscriptenInferAlignmentPass() {
+  return new InferAlignment();
+}
+
+} // End llvm namespace
@@ -17,9 +17,12 @@
 #include "JSTargetMachine.h"
 #include "MCTargetDesc/JSBackendMCTargetDesc.h"
 #include "AllocaManager.h"
+#include "JSSourceMap.h"
 #include "llvm/Analysis/ValueTracking.h"
+#include "llvm/ADT/MapVector.h"
 #include "llvm/ADT/SmallPtrSet.h"
 #include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/StringExtras.h"
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/Config/config.h"
@@ -36,6 +39,7 @@
 #include "llvm/IR/CallSite.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/FileSystem.h"
 #include "llvm/IR/GetElementPtrTypeIterator.h"
 #include "llvm/Support/MathExtras.h"
 #include "llvm/Support/ScopedPrinter.h"
@@ -60,6 +64,9 @@ using namespace llvm;
 #define DUMP(I) ((void)0)
 #endif
 
+// separates the source map markers from the code around them
+static const char SourceMapMarker = '\x1f';
+
 raw_ostream &prettyWarning() {
   errs().changeColor(raw_ostream::YELLOW);
   errs() << "warning:";
@@ -192,6 +199,48 @@ OnlyWebAssembly("emscripten-only-wasm",
                 cl::desc("Generate code that will only ever be used as WebAssembly, and is not valid JS or asm.js"),
                 cl::init(false));
 
+static cl::opt<std::string>
+SourceMapFile("emscripten-source-map",
+              cl::desc("Write a source map for the generated code to the given file"),
+              cl::init(""));
+
+static cl::opt<bool>
+FunctionTableStats("emscripten-function-table-stats",
+                   cl::desc("Print the number of functions and padding slots in each function table"),
+                   cl::init(false));
+
+static cl::opt<bool>
+Devirtualize("emscripten-devirtualize",
+             cl::desc("Emit indirect calls as direct calls when only one function can be in the function table they call through"),
+             cl::init(false));
+
+static cl::opt<unsigned>
+MemOpInlineMax("emscripten-mem-inline-max",
+               cl::desc("Largest constant length, in bytes, of a memcpy or memset that is emitted inline rather than as a call"),
+               cl::init(128));
+
+static cl::opt<unsigned>
+MemOpUnrollMax("emscripten-mem-unroll-max",
+               cl::desc("Most heap accesses of one size an inline memcpy or memset unrolls before emitting a loop, and most accesses in an inline memmove"),
+               cl::init(8));
+
+static cl::opt<bool>
+UnalignedReport("emscripten-unaligned-report",
+                cl::desc("Print the unaligned loads and stores in each function, functions with the most first"),
+                cl::init(false));
+
+static cl::opt<bool>
+FreeFunctionBodies("emscripten-free-function-bodies",
+                   cl::desc("Free the IR of each function once its code is emitted, so that the bodies are never all in memory together"),
+                   cl::init(false));
+
+static cl::opt<bool>
+EnableNarrowI64("emscripten-narrow-i64",
+                cl::desc("Narrow i64 operations that provably fit in 32 bits, or in a double, before lowering i64s"),
+                cl::init(true));
+
+// Defined with the GlobalizeConstantVectors pass.
+extern cl::opt<bool> GlobalizeLocalConstantVectors;
 
 extern "C" void LLVMInitializeJSBackendTarget() {
   // Register the target.
@@ -240,6 +289,7 @@ namespace {
   /// JSWriter - This class is the main chunk of code that converts an LLVM
   /// module to JavaScript.
   class JSWriter : public ModulePass {
+    LineCountingStream CountingOut; // wraps the output when emitting a source map
     raw_pwrite_stream &Out;
     Module *TheModule;
     unsigned UniqueNum;
@@ -275,6 +325,12 @@ namespace {
     // list of declared funcs whose type we must declare asm.js-style with a
     // usage, as they may not have another usage
     std::set<const Function*> DeclaresNeedingTypeDeclarations;
+    std::map<std::string, const Function*> OnlyTableTargets; // sig => the only function in that table, used to devirtualize
+    MapVector<const Function*, std::vector<std::string>> UnalignedSites; // for -emscripten-unaligned-report
+    SourceMapBuilder SourceMap;
+    // debug locations of the statements marked in the current function's
+    // code, which are turned into source map entries once it is relooped
+    std::vector<const DILocation*> SourceMapLocs;
 
     struct {
       // 0 is reserved for void type
@@ -312,46 +368,46 @@ namespace {
     #include "CallHandlers.h"
 
   public:
-  static bool UsesInt8Array;
-  static bool UsesUint8Array;
-  static bool UsesInt16Array;
-  static bool UsesUint16Array;
-  static bool UsesInt32Array;
-  static bool UsesUint32Array;
-  static bool UsesInt64Array; // JS does not have Int64Array/Uint64Array, but still track 64-bit accesses to be consistent
-  static bool UsesUint64Array;
-  static bool UsesFloat32Array;
-  static bool UsesFloat64Array;
-
-  static bool UsesNaN;
-  static bool UsesInfinity;
-
-  static bool UsesMathFloor;
-  static bool UsesMathAbs;
-  static bool UsesMathSqrt;
-  static bool UsesMathPow;
-  static bool UsesMathCos;
-  static bool UsesMathSin;
-  static bool UsesMathTan;
-  static bool UsesMathAcos;
-  static bool UsesMathAsin;
-  static bool UsesMathAtan;
-  static bool UsesMathAtan2;
-  static bool UsesMathExp;
-  static bool UsesMathLog;
-  static bool UsesMathCeil;
-  static bool UsesMathImul;
-  static bool UsesMathMin;
-  static bool UsesMathMax;
-  static bool UsesMathClz32;
-  static bool UsesMathFround;
-
-  static bool UsesThrew;
-  static bool UsesThrewValue;
+  bool UsesInt8Array = false;
+  bool UsesUint8Array = false;
+  bool UsesInt16Array = false;
+  bool UsesUint16Array = false;
+  bool UsesInt32Array = false;
+  bool UsesUint32Array = false;
+  bool UsesInt64Array = false; // JS does not have Int64Array/Uint64Array, but still track 64-bit accesses to be consistent
+  bool UsesUint64Array = false;
+  bool UsesFloat32Array = false;
+  bool UsesFloat64Array = false;
+
+  bool UsesNaN = false;
+  bool UsesInfinity = false;
+
+  bool UsesMathFloor = false;
+  bool UsesMathAbs = false;
+  bool UsesMathSqrt = false;
+  bool UsesMathPow = false;
+  bool UsesMathCos = false;
+  bool UsesMathSin = false;
+  bool UsesMathTan = false;
+  bool UsesMathAcos = false;
+  bool UsesMathAsin = false;
+  bool UsesMathAtan = false;
+  bool UsesMathAtan2 = false;
+  bool UsesMathExp = false;
+  bool UsesMathLog = false;
+  bool UsesMathCeil = false;
+  bool UsesMathImul = false;
+  bool UsesMathMin = false;
+  bool UsesMathMax = false;
+  bool UsesMathClz32 = false;
+  bool UsesMathFround = false;
+
+  bool UsesThrew = false;
+  bool UsesThrewValue = false;
 
   static char ID;
     JSWriter(raw_pwrite_stream &o, CodeGenOpt::Level OptLevel)
-      : ModulePass(ID), Out(o), UniqueNum(0), NextFunctionIndex(0), CantValidate(""),
+      : ModulePass(ID), CountingOut(o), Out(SourceMapFile.empty() ? o : CountingOut), UniqueNum(0), NextFunctionIndex(0), CantValidate(""),
         UsesSIMDUint8x16(false), UsesSIMDInt8x16(false), UsesSIMDUint16x8(false),
         UsesSIMDInt16x8(false), UsesSIMDUint32x4(false), UsesSIMDInt32x4(false),
         UsesSIMDFloat32x4(false), UsesSIMDFloat64x2(false), UsesSIMDBool8x16(false),
@@ -374,6 +430,9 @@ namespace {
 
     LLVM_ATTRIBUTE_NORETURN void error(const std::string& msg);
 
+    std::string ensureFloat(const std::string &S, Type *T);
+    std::string ensureFloat(const std::string &value, bool wrap);
+
     raw_pwrite_stream& nl(raw_pwrite_stream &Out, int delta = 0);
 
   private:
@@ -847,6 +906,19 @@ namespace {
       }
     }
 
+    // Marks the end of a statement in the function's code with the index of
+    // its location, so the generated line can be found after relooping. The
+    // markers are removed by addSourceMappings.
+    void emitSourceMapMarker(raw_ostream& Code, const Instruction *I) {
+      const DILocation *Loc = I->getDebugLoc().get();
+      if (Loc && Loc->getLine() > 0) {
+        Code << SourceMapMarker << SourceMapLocs.size() << SourceMapMarker;
+        SourceMapLocs.push_back(Loc);
+      }
+    }
+
+    void addSourceMappings(char *Buffer);
+
     std::string emitI64Const(uint64_t value) {
       return "i64_const(" + itostr(value & uint32_t(-1)) + "," + itostr((value >> 32) & uint32_t(-1)) + ")";
     }
@@ -902,6 +974,7 @@ namespace {
     /// @param Ptr [in] The heap object.
     /// @param HeapName [out] Receives the name of the HEAP object used to perform the memory acess.
     /// @return The index to the heap HeapName for the memory access.
+    const char *getHeapName(int Bytes, int Integer);
     std::string getHeapNameAndIndex(const Value *Ptr, const char **HeapName);
 
     // Like getHeapNameAndIndex(), but uses the given memory operation size and whether it is an Integer instead of the type of Ptr.
@@ -911,7 +984,7 @@ namespace {
     std::string getHeapNameAndIndexToGlobal(const GlobalVariable *GV, unsigned Bytes, bool Integer, const char **HeapName);
 
     /// Like getHeapNameAndIndex(), but for pointers represented in string expression form.
-    static std::string getHeapNameAndIndexToPtr(const std::string& Ptr, unsigned Bytes, bool Integer, const char **HeapName);
+    std::string getHeapNameAndIndexToPtr(const std::string& Ptr, unsigned Bytes, bool Integer, const char **HeapName);
 
     std::string getShiftedPtr(const Value *Ptr, unsigned Bytes);
 
@@ -919,7 +992,7 @@ namespace {
     std::string getPtrUse(const Value* Ptr);
 
     /// Like getPtrUse(), but for pointers represented in string expression form.
-    static std::string getHeapAccess(const std::string& Name, unsigned Bytes, bool Integer=true);
+    std::string getHeapAccess(const std::string& Name, unsigned Bytes, bool Integer=true);
 
     std::string getUndefValue(Type* T, AsmCast sign=ASM_SIGNED);
     std::string getConstant(const Constant*, AsmCast sign=ASM_SIGNED);
@@ -928,6 +1001,7 @@ namespace {
     std::string getValueAsStr(const Value*, AsmCast sign=ASM_SIGNED);
     std::string getValueAsCastStr(const Value*, AsmCast sign=ASM_SIGNED);
     std::string getValueAsParenStr(const Value*);
+    std::string getGEPExpression(const GEPOperator *GEP);
     std::string getValueAsCastParenStr(const Value*, AsmCast sign=ASM_SIGNED);
 
     const std::string &getJSName(const Value* val);
@@ -947,6 +1021,10 @@ namespace {
     std::string getIMul(const Value *, const Value *);
     std::string getLoad(const Instruction *I, const Value *P, Type *T, unsigned Alignment, char sep=';');
     std::string getStore(const Instruction *I, const Value *P, Type *T, const std::string& VS, unsigned Alignment, char sep=';');
+    std::string getUnalignedWordLoad(const std::string& PS, unsigned Offset, unsigned Alignment);
+    std::string getUnalignedWordStore(const std::string& PS, unsigned Offset, unsigned Alignment, const std::string& VS);
+    void noteUnalignedAccess(const Instruction *I, unsigned Bytes, unsigned Alignment);
+    void printUnalignedReport();
     std::string getStackBump(unsigned Size);
     std::string getStackBump(const std::string &Size);
 
@@ -970,6 +1048,7 @@ namespace {
     std::string getOpName(const Value*);
 
     void processConstants();
+    void layoutFunctionTables();
 
     // nativization
 
@@ -1057,7 +1136,7 @@ static inline void sanitizeLocal(std::string& str) {
   }
 }
 
-static inline std::string ensureFloat(const std::string &S, Type *T) {
+std::string JSWriter::ensureFloat(const std::string &S, Type *T) {
   if (PreciseF32 && T->isFloatTy()) {
     JSWriter::UsesMathFround = true;
     return "Math_fround(" + S + ')';
@@ -1065,7 +1144,7 @@ static inline std::string ensureFloat(const std::string &S, Type *T) {
   return S;
 }
 
-static inline std::string ensureFloat(const std::string &value, bool wrap) {
+std::string JSWriter::ensureFloat(const std::string &value, bool wrap) {
   if (wrap) {
     JSWriter::UsesMathFround = true;
     return "Math_fround(" + value + ')';
@@ -1321,41 +1400,7 @@ std::string JSWriter::getIMul(const Value *V1, const Value *V2) {
   return "Math_imul(" + getValueAsStr(V1) + ", " + getValueAsStr(V2) + ")|0"; // unknown or too large, emit imul
 }
 
-bool JSWriter::UsesInt8Array = false;
-bool JSWriter::UsesUint8Array = false;
-bool JSWriter::UsesInt16Array = false;
-bool JSWriter::UsesUint16Array = false;
-bool JSWriter::UsesInt32Array = false;
-bool JSWriter::UsesUint32Array = false;
-bool JSWriter::UsesInt64Array = false;
-bool JSWriter::UsesUint64Array = false;
-bool JSWriter::UsesFloat32Array = false;
-bool JSWriter::UsesFloat64Array = false;
-bool JSWriter::UsesNaN = false;
-bool JSWriter::UsesInfinity = false;
-bool JSWriter::UsesMathFloor = false;
-bool JSWriter::UsesMathAbs = false;
-bool JSWriter::UsesMathSqrt = false;
-bool JSWriter::UsesMathPow = false;
-bool JSWriter::UsesMathCos = false;
-bool JSWriter::UsesMathSin = false;
-bool JSWriter::UsesMathTan = false;
-bool JSWriter::UsesMathAcos = false;
-bool JSWriter::UsesMathAsin = false;
-bool JSWriter::UsesMathAtan = false;
-bool JSWriter::UsesMathAtan2 = false;
-bool JSWriter::UsesMathExp = false;
-bool JSWriter::UsesMathLog = false;
-bool JSWriter::UsesMathCeil = false;
-bool JSWriter::UsesMathImul = false;
-bool JSWriter::UsesMathMin = false;
-bool JSWriter::UsesMathMax = false;
-bool JSWriter::UsesMathClz32 = false;
-bool JSWriter::UsesMathFround = false;
-bool JSWriter::UsesThrew = false;
-bool JSWriter::UsesThrewValue = false;
-
-static inline const char *getHeapName(int Bytes, int Integer)
+const char *JSWriter::getHeapName(int Bytes, int Integer)
 {
   switch (Bytes) {
     default: llvm_unreachable("Unsupported type");
@@ -1447,6 +1492,77 @@ static const char *heapNameToAtomicTypeName(const char *HeapName)
   return "";
 }
 
+// Reads the 32-bit word at PS+Offset, which is only Alignment-aligned, by
+// combining smaller aligned reads.
+std::string JSWriter::getUnalignedWordLoad(const std::string& PS, unsigned Offset, unsigned Alignment) {
+  auto Addr = [&](unsigned Add) {
+    return Offset + Add ? PS + "+" + utostr(Offset + Add) : PS;
+  };
+  switch (Alignment) {
+    case 4:
+      UsesInt32Array = true;
+      return "HEAP32[" + Addr(0) + ">>2]";
+    case 2:
+      UsesUint16Array = true;
+      return "HEAPU16[" + Addr(0) + ">>1]|" +
+             "(HEAPU16[" + Addr(2) + ">>1]<<16)";
+    case 1:
+      UsesUint8Array = true;
+      return "HEAPU8[" + Addr(0) + ">>0]|" +
+             "(HEAPU8[" + Addr(1) + ">>0]<<8)|" +
+             "(HEAPU8[" + Addr(2) + ">>0]<<16)|" +
+             "(HEAPU8[" + Addr(3) + ">>0]<<24)";
+    default: llvm_unreachable("bad unaligned word alignment");
+  }
+}
+
+// Writes the 32-bit word VS to PS+Offset, which is only Alignment-aligned, as
+// smaller aligned writes. VS may be evaluated more than once.
+std::string JSWriter::getUnalignedWordStore(const std::string& PS, unsigned Offset, unsigned Alignment, const std::string& VS) {
+  auto Addr = [&](unsigned Add) {
+    return Offset + Add ? PS + "+" + utostr(Offset + Add) : PS;
+  };
+  switch (Alignment) {
+    case 4:
+      UsesInt32Array = true;
+      return "HEAP32[" + Addr(0) + ">>2]=" + VS;
+    case 2:
+      UsesInt16Array = true;
+      return "HEAP16[" + Addr(0) + ">>1]=" + VS + "&65535;" +
+             "HEAP16[" + Addr(2) + ">>1]=" + VS + ">>>16";
+    case 1:
+      UsesInt8Array = true;
+      return "HEAP8[" + Addr(0) + ">>0]=" + VS + "&255;" +
+             "HEAP8[" + Addr(1) + ">>0]=(" + VS + ">>8)&255;" +
+             "HEAP8[" + Addr(2) + ">>0]=(" + VS + ">>16)&255;" +
+             "HEAP8[" + Addr(3) + ">>0]=" + VS + ">>24";
+    default: llvm_unreachable("bad unaligned word alignment");
+  }
+}
+
+void JSWriter::noteUnalignedAccess(const Instruction *I, unsigned Bytes, unsigned Alignment) {
+  if (!UnalignedReport) return;
+  std::string Site;
+  raw_string_ostream OS(Site);
+  OS << (isa<StoreInst>(I) ? "store" : "load") << " of " << Bytes << " bytes with alignment " << Alignment;
+  emitDebugInfo(OS, I);
+  UnalignedSites[I->getParent()->getParent()].push_back(OS.str());
+}
+
+void JSWriter::printUnalignedReport() {
+  typedef std::pair<const Function*, std::vector<std::string>> FunctionSites;
+  std::vector<FunctionSites> Sorted(UnalignedSites.begin(), UnalignedSites.end());
+  std::stable_sort(Sorted.begin(), Sorted.end(), [](const FunctionSites &A, const FunctionSites &B) {
+    return A.second.size() > B.second.size();
+  });
+  for (auto &F : Sorted) {
+    errs() << "unaligned accesses in " << F.first->getName() << ": " << F.second.size() << "\n";
+    for (auto &Site : F.second) {
+      errs() << "  " << Site << "\n";
+    }
+  }
+}
+
 std::string JSWriter::getLoad(const Instruction *I, const Value *P, Type *T, unsigned Alignment, char sep) {
   std::string Assign = getAssign(I);
   unsigned Bytes = DL->getTypeAllocSize(T);
@@ -1466,6 +1582,7 @@ std::string JSWriter::getLoad(const Instruction *I, const Value *P, Type *T, uns
       emitDebugInfo(errs(), I);
       errs() << "\n";
     }
+    if (!Aligned) noteUnalignedAccess(I, Bytes, Alignment);
     if (T->isIntegerTy() || T->isPointerTy()) {
       switch (Bytes) {
         case 1:
@@ -1501,6 +1618,12 @@ std::string JSWriter::getLoad(const Instruction *I, const Value *P, Type *T, uns
       std::string Index = getHeapNameAndIndex(P, &HeapName);
       if (!strcmp(HeapName, "HEAP64")) {
         text = Assign + "i64_atomics_load(" + getValueAsStr(P) + ")";
+      } else if (OnlyWebAssembly && !strcmp(HeapName, "HEAPF32")) {
+        // there are no float atomics, but in wasm we can reinterpret the bits of an integer one
+        UsesInt32Array = true;
+        text = Assign + "i32_bc2f(Atomics_load(HEAP32," + Index + ")|0)";
+      } else if (OnlyWebAssembly && !strcmp(HeapName, "HEAPF64")) {
+        text = Assign + "i64_bc2d(i64_atomics_load(" + getValueAsStr(P) + "))";
       } else if (!strcmp(HeapName, "HEAPF32") || !strcmp(HeapName, "HEAPF64")) {
         bool fround = PreciseF32 && !strcmp(HeapName, "HEAPF32");
         // TODO: If https://bugzilla.mozilla.org/show_bug.cgi?id=1131613 and https://bugzilla.mozilla.org/show_bug.cgi?id=1131624 are
@@ -1531,81 +1654,30 @@ std::string JSWriter::getLoad(const Instruction *I, const Value *P, Type *T, uns
       emitDebugInfo(errs(), I);
       errs() << "\n";
     }
+    noteUnalignedAccess(I, Bytes, Alignment);
+    // Assemble the bits in registers from aligned reads. Integers are done at
+    // that point; floats have no way to reinterpret bits in asm.js other than
+    // through memory, so they take one aligned trip through tempDoublePtr.
     std::string PS = getValueAsStr(P);
     switch (Bytes) {
       case 8: {
-        switch (Alignment) {
-          case 4: {
-            UsesInt32Array = true;
-            text = "HEAP32[tempDoublePtr>>2]=HEAP32[" + PS + ">>2]" + sep +
-                    "HEAP32[tempDoublePtr+4>>2]=HEAP32[" + PS + "+4>>2]";
-            break;
-          }
-          case 2: {
-            UsesInt16Array = true;
-            text = "HEAP16[tempDoublePtr>>1]=HEAP16[" + PS + ">>1]" + sep +
-                   "HEAP16[tempDoublePtr+2>>1]=HEAP16[" + PS + "+2>>1]" + sep +
-                   "HEAP16[tempDoublePtr+4>>1]=HEAP16[" + PS + "+4>>1]" + sep +
-                   "HEAP16[tempDoublePtr+6>>1]=HEAP16[" + PS + "+6>>1]";
-            break;
-          }
-          case 1: {
-            UsesInt8Array = true;
-            text = "HEAP8[tempDoublePtr>>0]=HEAP8[" + PS + ">>0]" + sep +
-                   "HEAP8[tempDoublePtr+1>>0]=HEAP8[" + PS + "+1>>0]" + sep +
-                   "HEAP8[tempDoublePtr+2>>0]=HEAP8[" + PS + "+2>>0]" + sep +
-                   "HEAP8[tempDoublePtr+3>>0]=HEAP8[" + PS + "+3>>0]" + sep +
-                   "HEAP8[tempDoublePtr+4>>0]=HEAP8[" + PS + "+4>>0]" + sep +
-                   "HEAP8[tempDoublePtr+5>>0]=HEAP8[" + PS + "+5>>0]" + sep +
-                   "HEAP8[tempDoublePtr+6>>0]=HEAP8[" + PS + "+6>>0]" + sep +
-                   "HEAP8[tempDoublePtr+7>>0]=HEAP8[" + PS + "+7>>0]";
-            break;
-          }
-          default: assert(0 && "bad 8 store");
-        }
-        text += sep + Assign + "+HEAPF64[tempDoublePtr>>3]";
+        UsesInt32Array = true;
+        UsesFloat64Array = true;
+        unsigned WordAlignment = std::min(Alignment, 4U);
+        text = "HEAP32[tempDoublePtr>>2]=" + getUnalignedWordLoad(PS, 0, WordAlignment) + sep +
+               "HEAP32[tempDoublePtr+4>>2]=" + getUnalignedWordLoad(PS, 4, WordAlignment) + sep +
+               Assign + "+HEAPF64[tempDoublePtr>>3]";
         break;
       }
       case 4: {
         if (T->isIntegerTy() || T->isPointerTy()) {
-          switch (Alignment) {
-            case 2: {
-              UsesUint16Array = true;
-              text = Assign + "HEAPU16[" + PS + ">>1]|" +
-                             "(HEAPU16[" + PS + "+2>>1]<<16)";
-              break;
-            }
-            case 1: {
-              UsesUint8Array = true;
-              text = Assign + "HEAPU8[" + PS + ">>0]|" +
-                             "(HEAPU8[" + PS + "+1>>0]<<8)|" +
-                             "(HEAPU8[" + PS + "+2>>0]<<16)|" +
-                             "(HEAPU8[" + PS + "+3>>0]<<24)";
-              break;
-            }
-            default: assert(0 && "bad 4i store");
-          }
+          text = Assign + getUnalignedWordLoad(PS, 0, Alignment);
         } else { // float
           assert(T->isFloatingPointTy());
-          switch (Alignment) {
-            case 2: {
-              UsesInt16Array = true;
-              text = "HEAP16[tempDoublePtr>>1]=HEAP16[" + PS + ">>1]" + sep +
-                     "HEAP16[tempDoublePtr+2>>1]=HEAP16[" + PS + "+2>>1]";
-              break;
-            }
-            case 1: {
-              UsesInt8Array = true;
-              text = "HEAP8[tempDoublePtr>>0]=HEAP8[" + PS + ">>0]" + sep +
-                     "HEAP8[tempDoublePtr+1>>0]=HEAP8[" + PS + "+1>>0]" + sep +
-                     "HEAP8[tempDoublePtr+2>>0]=HEAP8[" + PS + "+2>>0]" + sep +
-                     "HEAP8[tempDoublePtr+3>>0]=HEAP8[" + PS + "+3>>0]";
-              break;
-            }
-            default: assert(0 && "bad 4f store");
-          }
+          UsesInt32Array = true;
           UsesFloat32Array = true;
-          text += sep + Assign + getCast("HEAPF32[tempDoublePtr>>2]", Type::getFloatTy(TheModule->getContext()));
+          text = "HEAP32[tempDoublePtr>>2]=" + getUnalignedWordLoad(PS, 0, Alignment) + sep +
+                 Assign + getCast("HEAPF32[tempDoublePtr>>2]", Type::getFloatTy(TheModule->getContext()));
         }
         break;
       }
@@ -1639,6 +1711,7 @@ std::string JSWriter::getStore(const Instruction *I, const Value *P, Type *T, co
       errs() << "\n";
     }
     if (!EnablePthreads || !cast<StoreInst>(I)->isVolatile() || FallbackUnalignedVolatileOperation) {
+      if (!Aligned) noteUnalignedAccess(I, Bytes, Alignment);
       if (T->isIntegerTy() || T->isPointerTy()) {
         switch (Bytes) {
           case 1:
@@ -1675,6 +1748,12 @@ std::string JSWriter::getStore(const Instruction *I, const Value *P, Type *T, co
       std::string Index = getHeapNameAndIndex(P, &HeapName);
       if (!strcmp(HeapName, "HEAP64")) {
         text = std::string("i64_atomics_store(") + getValueAsStr(P) + ',' + VS + ")|0";
+      } else if (OnlyWebAssembly && !strcmp(HeapName, "HEAPF32")) {
+        // there are no float atomics, but in wasm we can reinterpret the bits of an integer one
+        UsesInt32Array = true;
+        text = std::string("Atomics_store(HEAP32,") + Index + ",i32_bc2i(" + VS + "))|0";
+      } else if (OnlyWebAssembly && !strcmp(HeapName, "HEAPF64")) {
+        text = std::string("i64_atomics_store(") + getValueAsStr(P) + ",i64_bc2i(" + VS + "))|0";
       } else if (!strcmp(HeapName, "HEAPF32") || !strcmp(HeapName, "HEAPF64")) {
         // TODO: If https://bugzilla.mozilla.org/show_bug.cgi?id=1131613 and https://bugzilla.mozilla.org/show_bug.cgi?id=1131624 are
         // implemented, we could remove the emulation, but until then we must emulate manually.
@@ -1706,82 +1785,35 @@ std::string JSWriter::getStore(const Instruction *I, const Value *P, Type *T, co
       emitDebugInfo(errs(), I);
       errs() << "\n";
     }
+    noteUnalignedAccess(I, Bytes, Alignment);
+    // Floats go through tempDoublePtr once to get at their bits, which are
+    // then split in registers.
     std::string PS = getValueAsStr(P);
     switch (Bytes) {
       case 8: {
+        UsesInt32Array = true;
         UsesFloat64Array = true;
         text = "HEAPF64[tempDoublePtr>>3]=" + VS + ';';
-        switch (Alignment) {
-          case 4: {
-            UsesInt32Array = true;
-            text += "HEAP32[" + PS + ">>2]=HEAP32[tempDoublePtr>>2];" +
-                    "HEAP32[" + PS + "+4>>2]=HEAP32[tempDoublePtr+4>>2]";
-            break;
-          }
-          case 2: {
-            UsesInt16Array = true;
-            text += "HEAP16[" + PS + ">>1]=HEAP16[tempDoublePtr>>1];" +
-                    "HEAP16[" + PS + "+2>>1]=HEAP16[tempDoublePtr+2>>1];" +
-                    "HEAP16[" + PS + "+4>>1]=HEAP16[tempDoublePtr+4>>1];" +
-                    "HEAP16[" + PS + "+6>>1]=HEAP16[tempDoublePtr+6>>1]";
-            break;
-          }
-          case 1: {
-            UsesInt8Array = true;
-            text += "HEAP8[" + PS + ">>0]=HEAP8[tempDoublePtr>>0];" +
-                    "HEAP8[" + PS + "+1>>0]=HEAP8[tempDoublePtr+1>>0];" +
-                    "HEAP8[" + PS + "+2>>0]=HEAP8[tempDoublePtr+2>>0];" +
-                    "HEAP8[" + PS + "+3>>0]=HEAP8[tempDoublePtr+3>>0];" +
-                    "HEAP8[" + PS + "+4>>0]=HEAP8[tempDoublePtr+4>>0];" +
-                    "HEAP8[" + PS + "+5>>0]=HEAP8[tempDoublePtr+5>>0];" +
-                    "HEAP8[" + PS + "+6>>0]=HEAP8[tempDoublePtr+6>>0];" +
-                    "HEAP8[" + PS + "+7>>0]=HEAP8[tempDoublePtr+7>>0]";
-            break;
-          }
-          default: assert(0 && "bad 8 store");
+        if (Alignment >= 4) {
+          text += getUnalignedWordStore(PS, 0, 4, "HEAP32[tempDoublePtr>>2]") + ';' +
+                  getUnalignedWordStore(PS, 4, 4, "HEAP32[tempDoublePtr+4>>2]");
+        } else {
+          UsedVars["unaligned"] = i32;
+          text += "unaligned=HEAP32[tempDoublePtr>>2]|0;" + getUnalignedWordStore(PS, 0, Alignment, "unaligned") + ';' +
+                  "unaligned=HEAP32[tempDoublePtr+4>>2]|0;" + getUnalignedWordStore(PS, 4, Alignment, "unaligned");
         }
         break;
       }
       case 4: {
         if (T->isIntegerTy() || T->isPointerTy()) {
-          switch (Alignment) {
-            case 2: {
-              UsesInt16Array = true;
-              text = "HEAP16[" + PS + ">>1]=" + VS + "&65535;" +
-                     "HEAP16[" + PS + "+2>>1]=" + VS + ">>>16";
-              break;
-            }
-            case 1: {
-              UsesInt8Array = true;
-              text = "HEAP8[" + PS + ">>0]=" + VS + "&255;" +
-                     "HEAP8[" + PS + "+1>>0]=(" + VS + ">>8)&255;" +
-                     "HEAP8[" + PS + "+2>>0]=(" + VS + ">>16)&255;" +
-                     "HEAP8[" + PS + "+3>>0]=" + VS + ">>24";
-              break;
-            }
-            default: assert(0 && "bad 4i store");
-          }
+          text = getUnalignedWordStore(PS, 0, Alignment, VS);
         } else { // float
           assert(T->isFloatingPointTy());
+          UsesInt32Array = true;
           UsesFloat32Array = true;
-          text = "HEAPF32[tempDoublePtr>>2]=" + VS + ';';
-          switch (Alignment) {
-            case 2: {
-              UsesInt16Array = true;
-              text += "HEAP16[" + PS + ">>1]=HEAP16[tempDoublePtr>>1];" +
-                      "HEAP16[" + PS + "+2>>1]=HEAP16[tempDoublePtr+2>>1]";
-              break;
-            }
-            case 1: {
-              UsesInt8Array = true;
-              text += "HEAP8[" + PS + ">>0]=HEAP8[tempDoublePtr>>0];" +
-                      "HEAP8[" + PS + "+1>>0]=HEAP8[tempDoublePtr+1>>0];" +
-                      "HEAP8[" + PS + "+2>>0]=HEAP8[tempDoublePtr+2>>0];" +
-                      "HEAP8[" + PS + "+3>>0]=HEAP8[tempDoublePtr+3>>0]";
-              break;
-            }
-            default: assert(0 && "bad 4f store");
-          }
+          UsedVars["unaligned"] = i32;
+          text = "HEAPF32[tempDoublePtr>>2]=" + VS + ';' +
+                 "unaligned=HEAP32[tempDoublePtr>>2]|0;" + getUnalignedWordStore(PS, 0, Alignment, "unaligned");
         }
         break;
       }
@@ -2049,12 +2081,51 @@ std::string JSWriter::getConstantVector(const ConstantVectorType *C) {
   }
 }
 
+// Counts in Count how many loads and stores in BB use V as their address,
+// possibly through bitcasts. Returns false if V has any other use, or as soon
+// as a second such load or store is found, so that a value with many uses is
+// not walked in full each time it is printed.
+static bool getAddressUsesInBlock(const Value *V, const BasicBlock *BB, unsigned &Count) {
+  for (const User *U : V->users()) {
+    const Instruction *I = cast<Instruction>(U);
+    if (I->getParent() != BB) return false;
+    if (const LoadInst *LI = dyn_cast<LoadInst>(I)) {
+      if (LI->getPointerOperand() != V) return false;
+      Count++;
+    } else if (const StoreInst *SI = dyn_cast<StoreInst>(I)) {
+      if (SI->getPointerOperand() != V) return false;
+      Count++;
+    } else if (isa<BitCastInst>(I)) {
+      if (!getAddressUsesInBlock(I, BB, Count)) return false;
+    } else {
+      return false;
+    }
+    if (Count > 1) return false;
+  }
+  return true;
+}
+
+// A getelementptr with a constant offset whose only use is the address of a
+// load or store in its own block is not emitted on its own; instead the base
+// plus offset is written into that heap access, which saves a local and lets
+// the offset be folded into the access. Within a block, no phi can reassign
+// the base in between. With several accesses, computing the address once in
+// a local is smaller than repeating it in each.
+static bool isFoldedGEP(const Value *V) {
+  const GetElementPtrInst *GEP = dyn_cast<GetElementPtrInst>(V);
+  if (!GEP || !GEP->hasAllConstantIndices()) return false;
+  unsigned Count = 0;
+  return getAddressUsesInBlock(GEP, GEP->getParent(), Count) && Count == 1;
+}
+
 std::string JSWriter::getValueAsStr(const Value* V, AsmCast sign) {
   // Skip past no-op bitcasts and zero-index geps.
   V = stripPointerCastsWithoutSideEffects(V);
 
   if (const Constant *CV = dyn_cast<Constant>(V)) {
     return getConstant(CV, sign);
+  } else if (isFoldedGEP(V)) {
+    return getGEPExpression(cast<GEPOperator>(V));
   } else {
     return getJSName(V);
   }
@@ -2170,6 +2241,10 @@ void JSWriter::generateInsertElementExpression(const InsertElementInst *III, raw
         }
         Code << operand;
       }
+      // Promote smaller than 128-bit vector types to 128-bit since smaller ones do not exist in SIMD.js. (pad with zero lanes)
+      bool isInt = VT->getElementType()->isIntegerTy();
+      for (int Index = NumElems; Index < SIMDNumElements(VT); ++Index)
+        Code << ", " << ensureFloat(isInt ? "0" : "+0", !isInt);
       Code << ")";
     }
   } else {
@@ -2271,28 +2346,57 @@ void JSWriter::generateShuffleVectorExpression(const ShuffleVectorInst *SVI, raw
   }
 
   // Check whether can generate SIMD.js swizzle or shuffle.
-  std::string A = getValueAsStr(SVI->getOperand(0));
-  std::string B = getValueAsStr(SVI->getOperand(1));
-  VectorType *op0 = cast<VectorType>(SVI->getOperand(0)->getType());
+  const Value *OpA = SVI->getOperand(0);
+  const Value *OpB = SVI->getOperand(1);
+  VectorType *op0 = cast<VectorType>(OpA->getType());
   int OpNumElements = op0->getNumElements();
   int ResultNumElements = SVI->getType()->getNumElements();
   // Promote smaller than 128-bit vector types to 128-bit since smaller ones do not exist in SIMD.js. (pad with zero lanes)
   const int SIMDJsRetNumElements = SIMDNumElements(cast<VectorType>(SVI->getType()));
   const int SIMDJsOp0NumElements = SIMDNumElements(op0);
+
+  // Normalize the mask: lanes read from an undef operand are undef, and if
+  // both operands are the same value, read everything from the first one.
+  SmallVector<int, 16> Indices;
+  SVI->getShuffleMask(Indices);
+  bool AllUndef = true;
+  for (int &Mask : Indices) {
+    if (Mask >= OpNumElements && OpA == OpB) Mask -= OpNumElements;
+    if (Mask >= 0 && isa<UndefValue>(Mask < OpNumElements ? OpA : OpB)) Mask = -1;
+    if (Mask >= 0) AllUndef = false;
+  }
+  if (AllUndef) {
+    Code << getUndefValue(SVI->getType());
+    return;
+  }
+
   bool swizzleA = true;
   bool swizzleB = true;
+  bool identityA = ResultNumElements == OpNumElements;
+  bool identityB = ResultNumElements == OpNumElements;
   for(int i = 0; i < ResultNumElements; ++i) {
-    if (SVI->getMaskValue(i) >= OpNumElements) swizzleA = false;
-    if (SVI->getMaskValue(i) < OpNumElements) swizzleB = false;
+    int Mask = Indices[i];
+    if (Mask < 0) continue;
+    if (Mask >= OpNumElements) swizzleA = false;
+    if (Mask < OpNumElements) swizzleB = false;
+    if (Mask != i) identityA = false;
+    if (Mask != i + OpNumElements) identityB = false;
   }
   assert(!(swizzleA && swizzleB));
+  // A shuffle that just passes one operand through needs no code at all.
+  if ((swizzleA && identityA) || (swizzleB && identityB)) {
+    Code << getValueAsStr(swizzleA ? OpA : OpB);
+    return;
+  }
+  std::string A = getValueAsStr(OpA);
+  std::string B = getValueAsStr(OpB);
   if (swizzleA || swizzleB) {
     std::string T = (swizzleA ? A : B);
     Code << "SIMD_" << SIMDType(SVI->getType()) << "_swizzle(" << T;
     int i = 0;
     for (; i < ResultNumElements; ++i) {
       Code << ", ";
-      int Mask = SVI->getMaskValue(i);
+      int Mask = Indices[i];
       if (Mask < 0) {
         Code << 0;
       } else if (Mask < OpNumElements) {
@@ -2316,8 +2420,6 @@ void JSWriter::generateShuffleVectorExpression(const ShuffleVectorInst *SVI, raw
   Code << getSIMDCast(cast<VectorType>(SVI->getOperand(0)->getType()), SVI->getType(), A, /*signExtend=*/true, /*reinterpret=*/true) << ", "
        << getSIMDCast(cast<VectorType>(SVI->getOperand(1)->getType()), SVI->getType(), B, /*signExtend=*/true, /*reinterpret=*/true) << ", ";
 
-  SmallVector<int, 16> Indices;
-  SVI->getShuffleMask(Indices);
   for (unsigned int i = 0; i < Indices.size(); ++i) {
     if (i != 0)
       Code << ", ";
@@ -2744,6 +2846,52 @@ static std::string AddOffset(const std::string &base, int32_t Offset) {
   return "((" + base + ") + " + itostr(Offset) + "|0)";
 }
 
+std::string JSWriter::getGEPExpression(const GEPOperator *GEP) {
+  gep_type_iterator GTI = gep_type_begin(GEP);
+  int32_t ConstantOffset = 0;
+  std::string text;
+
+  // If the base is an initialized global variable, the address is just an
+  // integer constant, so we can fold it into the ConstantOffset directly.
+  const Value *Ptr = GEP->getPointerOperand()->stripPointerCasts();
+  if (isa<GlobalVariable>(Ptr) && cast<GlobalVariable>(Ptr)->hasInitializer() && !Relocatable) {
+    ConstantOffset = getGlobalAddress(Ptr->getName().str());
+  } else {
+    text = getValueAsParenStr(Ptr);
+  }
+
+  GetElementPtrInst::const_op_iterator I = GEP->op_begin();
+  I++;
+  for (GetElementPtrInst::const_op_iterator E = GEP->op_end();
+     I != E; ++I, ++GTI) {
+    const Value *Index = *I;
+    if (StructType *STy = GTI.getStructTypeOrNull()) {
+      // For a struct, add the member offset.
+      unsigned FieldNo = cast<ConstantInt>(Index)->getZExtValue();
+      uint32_t Offset = DL->getStructLayout(STy)->getElementOffset(FieldNo);
+      ConstantOffset = (uint32_t)ConstantOffset + Offset;
+    } else {
+      // For an array, add the element offset, explicitly scaled.
+      uint32_t ElementSize = DL->getTypeAllocSize(GTI.getIndexedType());
+      if (const ConstantInt *CI = dyn_cast<ConstantInt>(Index)) {
+        // The index is constant. Add it to the accumulating offset.
+        ConstantOffset = (uint32_t)ConstantOffset + (uint32_t)CI->getSExtValue() * ElementSize;
+      } else {
+        // The index is non-constant. To avoid reassociating, which increases
+        // the risk of slow wraparounds, add the accumulated offset first.
+        text = AddOffset(text, ConstantOffset);
+        ConstantOffset = 0;
+
+        // Now add the scaled dynamic index.
+        std::string Mul = getIMul(Index, ConstantInt::get(i32, ElementSize));
+        text = text.empty() ? Mul : ("(" + text + " + (" + Mul + ")|0)");
+      }
+    }
+  }
+  // Add in the final accumulated offset.
+  return AddOffset(text, ConstantOffset);
+}
+
 // Generate code for and operator, either an Instruction or a ConstantExpr.
 void JSWriter::generateExpression(const User *I, raw_string_ostream& Code) {
   // To avoid emiting code and variables for the no-op pointer bitcasts
@@ -3070,51 +3218,7 @@ void JSWriter::generateExpression(const User *I, raw_string_ostream& Code) {
     break;
   }
   case Instruction::GetElementPtr: {
-    Code << getAssignIfNeeded(I);
-    const GEPOperator *GEP = cast<GEPOperator>(I);
-    gep_type_iterator GTI = gep_type_begin(GEP);
-    int32_t ConstantOffset = 0;
-    std::string text;
-
-    // If the base is an initialized global variable, the address is just an
-    // integer constant, so we can fold it into the ConstantOffset directly.
-    const Value *Ptr = GEP->getPointerOperand()->stripPointerCasts();
-    if (isa<GlobalVariable>(Ptr) && cast<GlobalVariable>(Ptr)->hasInitializer() && !Relocatable) {
-      ConstantOffset = getGlobalAddress(Ptr->getName().str());
-    } else {
-      text = getValueAsParenStr(Ptr);
-    }
-
-    GetElementPtrInst::const_op_iterator I = GEP->op_begin();
-    I++;
-    for (GetElementPtrInst::const_op_iterator E = GEP->op_end();
-       I != E; ++I, ++GTI) {
-      const Value *Index = *I;
-      if (StructType *STy = GTI.getStructTypeOrNull()) {
-        // For a struct, add the member offset.
-        unsigned FieldNo = cast<ConstantInt>(Index)->getZExtValue();
-        uint32_t Offset = DL->getStructLayout(STy)->getElementOffset(FieldNo);
-        ConstantOffset = (uint32_t)ConstantOffset + Offset;
-      } else {
-        // For an array, add the element offset, explicitly scaled.
-        uint32_t ElementSize = DL->getTypeAllocSize(GTI.getIndexedType());
-        if (const ConstantInt *CI = dyn_cast<ConstantInt>(Index)) {
-          // The index is constant. Add it to the accumulating offset.
-          ConstantOffset = (uint32_t)ConstantOffset + (uint32_t)CI->getSExtValue() * ElementSize;
-        } else {
-          // The index is non-constant. To avoid reassociating, which increases
-          // the risk of slow wraparounds, add the accumulated offset first.
-          text = AddOffset(text, ConstantOffset);
-          ConstantOffset = 0;
-
-          // Now add the scaled dynamic index.
-          std::string Mul = getIMul(Index, ConstantInt::get(i32, ElementSize));
-          text = text.empty() ? Mul : ("(" + text + " + (" + Mul + ")|0)");
-        }
-      }
-    }
-    // Add in the final accumulated offset.
-    Code << AddOffset(text, ConstantOffset);
+    Code << getAssignIfNeeded(I) << getGEPExpression(cast<GEPOperator>(I));
     break;
   }
   case Instruction::PHI: {
@@ -3338,10 +3442,111 @@ void JSWriter::generateExpression(const User *I, raw_string_ostream& Code) {
     Code << ';';
     // append debug info
     emitDebugInfo(Code, Inst);
+    if (!SourceMapFile.empty())
+      emitSourceMapMarker(Code, Inst);
     Code << '\n';
   }
 }
 
+// Records a source map entry for each statement marked in the relooped code of
+// a function, and removes the markers. Each statement's generated position is
+// the start of the line it ends on.
+void JSWriter::addSourceMappings(char *Buffer) {
+  unsigned Line = CountingOut.getLine();
+  char *LineStart = Buffer;
+  char *Dest = Buffer;
+  for (char *Src = Buffer; *Src; ) {
+    if (*Src == SourceMapMarker) {
+      char *End;
+      unsigned long Index = strtoul(Src + 1, &End, 10);
+      assert(*End == SourceMapMarker && Index < SourceMapLocs.size());
+      const DILocation *Loc = SourceMapLocs[Index];
+      char *Start = LineStart;
+      while (Start < Dest && *Start == ' ') Start++;
+      SourceMap.addMapping(Line, Start - LineStart, Loc->getFilename(), Loc->getLine(), Loc->getColumn());
+      Src = End + 1;
+      continue;
+    }
+    if (*Src == '\n') {
+      Line++;
+      LineStart = Dest + 1;
+    }
+    *Dest++ = *Src++;
+  }
+  *Dest = 0;
+  SourceMapLocs.clear();
+}
+
+// Counts the uses of V that take its address, rather than call it, in code and
+// in initializers of globals that are emitted.
+static unsigned countAddressUses(const Value *V) {
+  unsigned Count = 0;
+  for (const Use &U : V->uses()) {
+    const User *Usr = U.getUser();
+    ImmutableCallSite CS(Usr);
+    if (CS) {
+      if (!CS.isCallee(&U)) Count++;
+    } else if (isa<Instruction>(Usr)) {
+      Count++;
+    } else if (const GlobalVariable *GV = dyn_cast<GlobalVariable>(Usr)) {
+      if (!GV->getName().startswith("llvm.")) Count++;
+    } else if (isa<ConstantExpr>(Usr) || isa<ConstantAggregate>(Usr) || isa<GlobalAlias>(Usr)) {
+      Count += countAddressUses(Usr);
+    }
+  }
+  return Count;
+}
+
+// Assigns function table indices to all the functions whose address is taken
+// before anything is emitted, rather than leaving the order to whichever use
+// happens to be emitted first. The most referenced functions come first in
+// each table. With NoAliasingFunctionPointers, where indices are unique across
+// tables and every table is padded up to its last index, the functions are
+// also packed by signature, smallest tables first, which keeps the padding
+// down. Functions found later (e.g. ones only reached through invoke) are
+// still indexed on first use.
+void JSWriter::layoutFunctionTables() {
+  typedef std::pair<unsigned, const Function*> Target;
+  typedef std::vector<Target> TargetList;
+  std::map<std::string, TargetList> TargetsBySig;
+  for (const Function &F : *TheModule) {
+    if (F.isIntrinsic()) continue;
+    if (unsigned Count = countAddressUses(&F)) {
+      TargetsBySig[getFunctionSignature(F.getFunctionType())].push_back(Target(Count, &F));
+    }
+  }
+  std::vector<TargetList*> Tables;
+  for (auto &I : TargetsBySig) {
+    std::stable_sort(I.second.begin(), I.second.end(),
+                     [](const Target &A, const Target &B) { return A.first > B.first; });
+    Tables.push_back(&I.second);
+  }
+  std::stable_sort(Tables.begin(), Tables.end(),
+                   [](const TargetList *A, const TargetList *B) { return A->size() < B->size(); });
+
+  // Calls through a table that can only ever hold one function can call it
+  // directly (anything else in that table would be a null or bad pointer).
+  // That needs all the table contents to be known here: nothing may be added
+  // at runtime or by other modules, and no function may first be indexed later
+  // for an invoke.
+  const Function *PreInvoke = TheModule->getFunction("emscripten_preinvoke");
+  if (Devirtualize && !Relocatable && !EmulatedFunctionPointers && !EmulateFunctionPointerCasts &&
+      ReservedFunctionPointers == 0 && EmscriptenAssertions == 0 &&
+      !(PreInvoke && !PreInvoke->use_empty())) {
+    for (auto &I : TargetsBySig) {
+      const Function *F = I.second[0].second;
+      if (I.second.size() == 1 && !F->isDeclaration() && !F->isVarArg()) {
+        OnlyTableTargets[I.first] = F;
+      }
+    }
+  }
+  for (TargetList *Table : Tables) {
+    for (const Target &T : *Table) {
+      getFunctionIndex(T.second);
+    }
+  }
+}
+
 // Checks whether to use a condition variable. We do so for switches and for indirectbrs
 static const Value *considerConditionVar(const Instruction *I) {
   if (const IndirectBrInst *IB = dyn_cast<const IndirectBrInst>(I)) {
@@ -3359,7 +3564,7 @@ void JSWriter::addBlock(const BasicBlock *BB, Relooper& R, LLVMToRelooperMap& LL
   for (BasicBlock::const_iterator II = BB->begin(), E = BB->end();
        II != E; ++II) {
     auto I = &*II;
-    if (stripPointerCastsWithoutSideEffects(I) == I) {
+    if (stripPointerCastsWithoutSideEffects(I) == I && !isFoldedGEP(I)) {
       CurrInstruction = I;
       generateExpression(I, CodeStream);
     }
@@ -3593,7 +3798,10 @@ void JSWriter::printFunctionBody(const Function *F) {
 
   // Emit (relooped) code
   char *buffer = Relooper::GetOutputBuffer();
-  nl(Out) << buffer;
+  nl(Out);
+  if (!SourceMapFile.empty())
+    addSourceMappings(buffer);
+  Out << buffer;
 
   // Ensure a final return if necessary
   Type *RT = F->getFunctionType()->getReturnType();
@@ -3730,6 +3938,10 @@ void JSWriter::printFunction(const Function *F) {
 
   std::string Name = F->getName();
   sanitizeGlobal(Name);
+  if (!SourceMapFile.empty()) {
+    if (const DISubprogram *SP = F->getSubprogram())
+      SourceMap.addMapping(CountingOut.getLine(), 0, SP->getFilename(), SP->getLine(), 0, SP->getName());
+  }
   Out << "function " << Name << "(";
   for (Function::const_arg_iterator AI = F->arg_begin(), AE = F->arg_end();
        AI != AE; ++AI) {
@@ -3753,7 +3965,17 @@ void JSWriter::printFunction(const Function *F) {
   StackBumped = false;
 }
 
+// Frees the body of F once it has been emitted, by replacing it with a single
+// unreachable. That drops its references to other values, but F is still a
+// definition with its original linkage for whatever is emitted after it.
+static void freeFunctionBody(Function &F) {
+  F.dropAllReferences();
+  BasicBlock *BB = BasicBlock::Create(F.getContext(), "", &F);
+  new UnreachableInst(F.getContext(), BB);
+}
+
 void JSWriter::printModuleBody() {
+  layoutFunctionTables();
   processConstants();
   handleEmJsFunctions();
 
@@ -3767,12 +3989,19 @@ void JSWriter::printModuleBody() {
     }
   }
 
+  // Which declarations are used must be known before the bodies using them
+  // are freed.
+  std::vector<const Function*> UsedDeclarations;
+  for (const Function &F : *TheModule) {
+    if (F.isDeclaration() && !F.use_empty()) UsedDeclarations.push_back(&F);
+  }
+
   // Emit function bodies.
   nl(Out) << "// EMSCRIPTEN_START_FUNCTIONS"; nl(Out);
-  for (Module::const_iterator II = TheModule->begin(), E = TheModule->end();
-       II != E; ++II) {
-    auto I = &*II;
-    if (!I->isDeclaration()) printFunction(I);
+  for (Function &F : *TheModule) {
+    if (F.isDeclaration()) continue;
+    printFunction(&F);
+    if (FreeFunctionBodies) freeFunctionBody(F);
   }
   // Emit postSets, split up into smaller functions to avoid one massive one
   // that is slow to compile (more likely to occur in dynamic linking, as more
@@ -3900,58 +4129,55 @@ void JSWriter::printModuleBody() {
 
   Out << "\"declares\": [";
   bool first = true;
-  for (Module::const_iterator I = TheModule->begin(), E = TheModule->end();
-       I != E; ++I) {
-    if (I->isDeclaration() && !I->use_empty()) {
-      // Ignore intrinsics that are always no-ops or expanded into other code
-      // which doesn't require the intrinsic function itself to be declared.
-      if (I->isIntrinsic()) {
-        switch (I->getIntrinsicID()) {
-        default: break;
-        case Intrinsic::dbg_declare:
-        case Intrinsic::dbg_value:
-        case Intrinsic::lifetime_start:
-        case Intrinsic::lifetime_end:
-        case Intrinsic::invariant_start:
-        case Intrinsic::invariant_end:
-        case Intrinsic::prefetch:
-        case Intrinsic::memcpy:
-        case Intrinsic::memset:
-        case Intrinsic::memmove:
-        case Intrinsic::expect:
-        case Intrinsic::flt_rounds:
-          continue;
-        }
-      }
-      // Do not report methods implemented in a call handler, unless
-      // they are accessed by a function pointer (in which case, we
-      // need the expected name to be available TODO: optimize
-      // that out, call handlers can declare their "function table
-      // name").
-      std::string fullName = getJSName(&*I);
-      if (CallHandlers.count(fullName) > 0) {
-        if (IndexedFunctions.find(fullName) == IndexedFunctions.end()) {
-          continue;
-        }
+  for (const Function *I : UsedDeclarations) {
+    // Ignore intrinsics that are always no-ops or expanded into other code
+    // which doesn't require the intrinsic function itself to be declared.
+    if (I->isIntrinsic()) {
+      switch (I->getIntrinsicID()) {
+      default: break;
+      case Intrinsic::dbg_declare:
+      case Intrinsic::dbg_value:
+      case Intrinsic::lifetime_start:
+      case Intrinsic::lifetime_end:
+      case Intrinsic::invariant_start:
+      case Intrinsic::invariant_end:
+      case Intrinsic::prefetch:
+      case Intrinsic::memcpy:
+      case Intrinsic::memset:
+      case Intrinsic::memmove:
+      case Intrinsic::expect:
+      case Intrinsic::flt_rounds:
+        continue;
       }
-      // Do not emit EM_JS functions as "declare"s, they're handled specially
-      // as "emJsFuncs". Emitting them here causes Emscripten library code to
-      // generate stubs that throw "missing library function" when called.
-      if (EmJsFunctions.count(fullName) > 0) {
+    }
+    // Do not report methods implemented in a call handler, unless
+    // they are accessed by a function pointer (in which case, we
+    // need the expected name to be available TODO: optimize
+    // that out, call handlers can declare their "function table
+    // name").
+    std::string fullName = getJSName(I);
+    if (CallHandlers.count(fullName) > 0) {
+      if (IndexedFunctions.find(fullName) == IndexedFunctions.end()) {
         continue;
       }
+    }
+    // Do not emit EM_JS functions as "declare"s, they're handled specially
+    // as "emJsFuncs". Emitting them here causes Emscripten library code to
+    // generate stubs that throw "missing library function" when called.
+    if (EmJsFunctions.count(fullName) > 0) {
+      continue;
+    }
 
-      if (I->hasExternalWeakLinkage()) {
-        WeakDeclares.insert(fullName);
-      }
+    if (I->hasExternalWeakLinkage()) {
+      WeakDeclares.insert(fullName);
+    }
 
-      if (first) {
-        first = false;
-      } else {
-        Out << ", ";
-      }
-      Out << "\"" << fullName.substr(1) << "\"";
+    if (first) {
+      first = false;
+    } else {
+      Out << ", ";
     }
+    Out << "\"" << fullName.substr(1) << "\"";
   }
   for (NameSet::const_iterator I = Declares.begin(), E = Declares.end();
        I != E; ++I) {
@@ -4035,6 +4261,7 @@ void JSWriter::printModuleBody() {
 
   Out << "\"tables\": {";
   unsigned Num = FunctionTables.size();
+  unsigned TotalFunctions = 0, TotalSlots = 0;
   for (FunctionTableMap::iterator I = FunctionTables.begin(), E = FunctionTables.end(); I != E; ++I) {
     Out << "  \"" << I->first << "\": \"var FUNCTION_TABLE_" << I->first << " = [";
     // wasm emulated function pointers use just one table
@@ -4044,6 +4271,12 @@ void JSWriter::printModuleBody() {
       unsigned Size = 1;
       while (Size < Table.size()) Size <<= 1;
       while (Table.size() < Size) Table.push_back("0");
+      if (FunctionTableStats) {
+        unsigned Functions = Table.size() - std::count(Table.begin(), Table.end(), "0");
+        errs() << "function table " << I->first << ": " << Functions << " functions in " << Table.size() << " slots\n";
+        TotalFunctions += Functions;
+        TotalSlots += Table.size();
+      }
       for (unsigned i = 0; i < Table.size(); i++) {
         Out << Table[i];
         if (i < Table.size()-1) Out << ",";
@@ -4054,6 +4287,9 @@ void JSWriter::printModuleBody() {
     Out << "\n";
   }
   Out << "},";
+  if (FunctionTableStats) {
+    errs() << "function tables: " << TotalFunctions << " functions in " << TotalSlots << " slots, " << (TotalSlots - TotalFunctions) << " padding\n";
+  }
 
   Out << "\"initializers\": [";
   first = true;
@@ -4746,7 +4982,18 @@ bool JSWriter::runOnModule(Module &M) {
 
   printProgram("", "");
 
-  return false;
+  if (UnalignedReport)
+    printUnalignedReport();
+
+  if (!SourceMapFile.empty()) {
+    std::error_code EC;
+    raw_fd_ostream SourceMapOut(SourceMapFile, EC, sys::fs::F_Text);
+    if (EC)
+      report_fatal_error("cannot open source map file " + SourceMapFile + ": " + EC.message());
+    SourceMap.write(SourceMapOut);
+  }
+
+  return FreeFunctionBodies;
 }
 
 char JSWriter::ID = 0;
@@ -4861,6 +5108,12 @@ bool JSTargetMachine::addPassesToEmitFile(PassManagerBase &PM, raw_pwrite_stream
     // This pass converts those arguments to 32-bit.
     PM.add(createCanonicalizeMemIntrinsicsPass());
 
+    // Constant vectors are printed directly, so GlobalizeConstantVectors only
+    // runs when asked to rebuild them once at function entry, which keeps
+    // their construction out of loops.
+    if (GlobalizeLocalConstantVectors)
+      PM.add(createGlobalizeConstantVectorsPass());
+
     // ConstantMerge cleans up after passes such as GlobalizeConstantVectors. It
     // must run before the FlattenGlobals pass because FlattenGlobals loses
     // information that otherwise helps ConstantMerge do a good job.
@@ -4873,8 +5126,13 @@ bool JSTargetMachine::addPassesToEmitFile(PassManagerBase &PM, raw_pwrite_stream
 
     // The type legalization passes (ExpandLargeIntegers and PromoteIntegers) do
     // not handle constexprs and create GEPs, so they go between those passes.
+    // PromoteIntegers is split into a module-level signature rewrite and a
+    // function-level body, so that the pass manager runs the body together
+    // with ExpandLargeIntegers on one function at a time instead of walking
+    // the whole module twice.
+    PM.add(createPromoteIntegerSignaturesPass());
     PM.add(createExpandLargeIntegersPass());
-    PM.add(createPromoteIntegersPass());
+    PM.add(createPromoteIntegerInstructionsPass());
     // Rewrite atomic and volatile instructions with intrinsic calls.
     PM.add(createRewriteAtomicsPass());
 
@@ -4892,7 +5150,11 @@ bool JSTargetMachine::addPassesToEmitFile(PassManagerBase &PM, raw_pwrite_stream
   PM.add(createExpandInsertExtractElementPass());
 
   if (!OnlyWebAssembly) {
-    // if only wasm, then we can emit i64s, otherwise they must be lowered
+    // if only wasm, then we can emit i64s, otherwise they must be lowered.
+    // Narrow what provably fits in 32 bits first, as that is far cheaper
+    // than the chunked lowering.
+    if (EnableNarrowI64)
+      PM.add(createNarrowI64Pass());
     PM.add(createExpandI64Pass());
   }
   if (!EnablePthreads) {
@@ -4907,6 +5169,11 @@ bool JSTargetMachine::addPassesToEmitFile(PassManagerBase &PM, raw_pwrite_stream
   if (OptLevel == CodeGenOpt::None)
     PM.add(createEmscriptenSimplifyAllocasPass());
 
+  // Prove what alignment we can while llvm.assume calls are still around, as
+  // unaligned accesses are much slower.
+  if (OptLevel != CodeGenOpt::None)
+    PM.add(createEmscriptenInferAlignmentPass());
+
   PM.add(createEmscriptenRemoveLLVMAssumePass());
   PM.add(createEmscriptenExpandBigSwitchesPass());
 
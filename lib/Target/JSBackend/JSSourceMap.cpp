@@ -0,0 +1,124 @@
+//===-- JSSourceMap.cpp ---------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file implements source map generation for the JS backend. The format
+// is described at https://sourcemaps.info/spec.html
+//
+//===----------------------------------------------------------------------===//
+
+#include "JSSourceMap.h"
+#include "llvm/Support/Format.h"
+#include <algorithm>
+
+using namespace llvm;
+
+void LineCountingStream::write_impl(const char *Ptr, size_t Size) {
+  Lines += std::count(Ptr, Ptr + Size, '\n');
+  OS.write(Ptr, Size);
+}
+
+static unsigned getIndex(StringRef Str, StringMap<unsigned> &Indices,
+                         std::vector<std::string> &List) {
+  auto Inserted = Indices.insert(std::make_pair(Str, List.size()));
+  if (Inserted.second)
+    List.push_back(Str);
+  return Inserted.first->second;
+}
+
+void SourceMapBuilder::addMapping(unsigned GeneratedLine,
+                                  unsigned GeneratedColumn, StringRef File,
+                                  unsigned Line, unsigned Column,
+                                  StringRef Name) {
+  Mapping M;
+  M.GeneratedLine = GeneratedLine;
+  M.GeneratedColumn = GeneratedColumn;
+  M.Source = getIndex(File.empty() ? "?" : File, SourceIndices, Sources);
+  M.Line = Line > 0 ? Line - 1 : 0;
+  M.Column = Column > 0 ? Column - 1 : 0;
+  M.Name = Name.empty() ? -1 : getIndex(Name, NameIndices, Names);
+  Mappings.push_back(M);
+}
+
+// Writes Value as a base64 VLQ: the sign goes in the lowest bit, then five
+// bits per digit, least significant first, with bit 6 set on all but the last.
+static void writeVLQ(raw_ostream &OS, int Value) {
+  static const char Base64[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  unsigned V = Value < 0 ? ((unsigned)-Value << 1) | 1 : (unsigned)Value << 1;
+  do {
+    unsigned Digit = V & 31;
+    V >>= 5;
+    if (V)
+      Digit |= 32;
+    OS << Base64[Digit];
+  } while (V);
+}
+
+static void writeStringList(raw_ostream &OS,
+                            const std::vector<std::string> &List) {
+  OS << '[';
+  for (unsigned i = 0; i < List.size(); i++) {
+    if (i > 0)
+      OS << ',';
+    OS << '"';
+    for (char C : List[i]) {
+      if (C == '"' || C == '\\')
+        OS << '\\' << C;
+      else if ((unsigned char)C < 0x20)
+        OS << format("\\u%04x", C);
+      else
+        OS << C;
+    }
+    OS << '"';
+  }
+  OS << ']';
+}
+
+void SourceMapBuilder::write(raw_ostream &OS) {
+  std::stable_sort(Mappings.begin(), Mappings.end(),
+                   [](const Mapping &A, const Mapping &B) {
+    if (A.GeneratedLine != B.GeneratedLine)
+      return A.GeneratedLine < B.GeneratedLine;
+    return A.GeneratedColumn < B.GeneratedColumn;
+  });
+
+  OS << "{\"version\":3,\"sources\":";
+  writeStringList(OS, Sources);
+  OS << ",\"names\":";
+  writeStringList(OS, Names);
+  OS << ",\"mappings\":\"";
+  // Everything but the generated column is relative to the previous segment
+  // in the whole map; the generated column restarts on each line.
+  unsigned Line = 0, Column = 0;
+  int PrevSource = 0, PrevLine = 0, PrevColumn = 0, PrevName = 0;
+  bool FirstInLine = true;
+  for (const Mapping &M : Mappings) {
+    for (; Line < M.GeneratedLine; Line++) {
+      OS << ';';
+      Column = 0;
+      FirstInLine = true;
+    }
+    if (!FirstInLine)
+      OS << ',';
+    FirstInLine = false;
+    writeVLQ(OS, (int)M.GeneratedColumn - (int)Column);
+    writeVLQ(OS, (int)M.Source - PrevSource);
+    writeVLQ(OS, (int)M.Line - PrevLine);
+    writeVLQ(OS, (int)M.Column - PrevColumn);
+    if (M.Name >= 0) {
+      writeVLQ(OS, M.Name - PrevName);
+      PrevName = M.Name;
+    }
+    Column = M.GeneratedColumn;
+    PrevSource = M.Source;
+    PrevLine = M.Line;
+    PrevColumn = M.Column;
+  }
+  OS << "\"}\n";
+}
@@ -0,0 +1,78 @@
+//===-- JSSourceMap.h -----------------------------------------------------===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===----------------------------------------------------------------------===//
+//
+// This file declares the classes the JS backend uses to emit source maps.
+//
+//===----------------------------------------------------------------------===//
+
+#ifndef JSBACKEND_JSSOURCEMAP_H
+#define JSBACKEND_JSSOURCEMAP_H
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/raw_ostream.h"
+#include <string>
+#include <vector>
+
+namespace llvm {
+
+/// Forwards everything written to it to another stream, keeping count of the
+/// lines written so far.
+class LineCountingStream : public raw_pwrite_stream {
+  raw_pwrite_stream &OS;
+  unsigned Lines;
+
+  void write_impl(const char *Ptr, size_t Size) override;
+  void pwrite_impl(const char *Ptr, size_t Size, uint64_t Offset) override {
+    OS.pwrite(Ptr, Size, Offset);
+  }
+  uint64_t current_pos() const override { return OS.tell(); }
+
+public:
+  explicit LineCountingStream(raw_pwrite_stream &OS)
+      : raw_pwrite_stream(/*Unbuffered=*/true), OS(OS), Lines(0) {}
+
+  /// Returns the zero-based index of the line being written.
+  unsigned getLine() const { return Lines; }
+};
+
+/// Collects mappings from positions in the generated code to source
+/// locations, and writes them out as a version 3 source map.
+class SourceMapBuilder {
+  struct Mapping {
+    unsigned GeneratedLine;
+    unsigned GeneratedColumn;
+    unsigned Source;
+    unsigned Line;
+    unsigned Column;
+    int Name;
+  };
+
+  std::vector<Mapping> Mappings;
+  std::vector<std::string> Sources;
+  StringMap<unsigned> SourceIndices;
+  std::vector<std::string> Names;
+  StringMap<unsigned> NameIndices;
+
+public:
+  /// Adds a mapping. Generated positions are zero-based; the source line and
+  /// column are one-based as in debug info, with column 0 meaning unknown.
+  void addMapping(unsigned GeneratedLine, unsigned GeneratedColumn,
+                  StringRef File, unsigned Line, unsigned Column,
+                  StringRef Name = StringRef());
+
+  bool empty() const { return Mappings.empty(); }
+
+  /// Writes the source map as JSON.
+  void write(raw_ostream &OS);
+};
+
+} // End llvm namespace
+
+#endif
@@ -22,9 +22,17 @@
 // like addition are lowered into calls into library support code in
 // Emscripten (i64Add for example).
 //
+// Chunks which are statically known (a zero high word from a zext, for
+// example) let some operations skip the library call: additions, unsigned
+// divisions and comparisons of narrow values, and shifts by a constant, are
+// done inline on the 32-bit chunks. High words are only kept if something
+// uses them; a library call whose getHigh32 turns out to be unused is
+// replaced by the equivalent 32-bit operation where one exists.
+//
 //===------------------------------------------------------------------===//
 
 #include "llvm/ADT/PostOrderIterator.h"
+#include "llvm/ADT/SetVector.h"
 #include "llvm/ADT/SmallString.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/StringExtras.h"
@@ -60,6 +68,15 @@ namespace {
   typedef SmallVector<PHINode *, 8> PHIVec;
   typedef SmallVector<Instruction *, 8> DeadVec;
 
+  // A library call returning the low word, and the getHigh32 call right after
+  // it which reads the high word. If nothing ends up using the high word, the
+  // pair can be replaced by LowOp on the low chunks, when LowOp is valid.
+  struct HelperCall {
+    CallInst *Low, *High;
+    Instruction::BinaryOps LowOp;
+  };
+  typedef SmallVector<HelperCall, 8> HelperCallVec;
+
   // This is a ModulePass because the pass recreates functions in
   // order to expand i64 arguments to pairs of i32s.
   class ExpandI64 : public ModulePass {
@@ -70,6 +87,8 @@ namespace {
     SplitsMap Splits; // old illegal value to new insts
     PHIVec Phis;
     std::vector<PhiBlockChange> PhiBlockChanges;
+    HelperCallVec HelperCalls;
+    DeadVec HighChunks; // instructions computing only a high chunk
 
     // If the function has an illegal return or argument, create a legal version
     void ensureLegalFunc(Function *F);
@@ -104,6 +123,15 @@ namespace {
     void ensureFuncs();
     unsigned getNumChunks(Type *T);
 
+    // Lowers a 64-bit shift by a constant amount into 32-bit operations on
+    // the chunks. Returns false if the amount is out of range.
+    bool splitConstantShift(Instruction *I, unsigned Shifts,
+                            const ChunksVec &LeftChunks, ChunksVec &Chunks);
+
+    // Removes high chunks nobody ended up using, after the function has been
+    // fully split.
+    void removeUnusedHighChunks();
+
   public:
     static char ID;
     ExpandI64() : ModulePass(ID) {
@@ -484,54 +512,72 @@ bool ExpandI64::splitInst(Instruction *I) {
       ChunksVec RightChunks = getChunks(I->getOperand(1));
       unsigned Num = getNumChunks(I->getType());
       if (Num == 2) {
+        // Both high words are zero, i.e. the operands are zero-extended
+        // 32-bit values.
+        bool Narrow = LeftChunks[1] == Zero && RightChunks[1] == Zero;
+        switch (I->getOpcode()) {
+          case Instruction::Add: {
+            if (!Narrow) break;
+            // The high word is just the carry out of the low word.
+            Instruction *Low = CopyDebug(BinaryOperator::Create(Instruction::Add, LeftChunks[0], RightChunks[0], "", I), I);
+            Instruction *Carry = CopyDebug(new ICmpInst(I, ICmpInst::ICMP_ULT, Low, LeftChunks[0]), I);
+            Chunks.push_back(Low);
+            Chunks.push_back(CopyDebug(new ZExtInst(Carry, i32, "", I), I));
+            return true;
+          }
+          case Instruction::Sub: {
+            if (!Narrow) break;
+            // The high word is all ones if there was a borrow, zero otherwise.
+            Instruction *Low = CopyDebug(BinaryOperator::Create(Instruction::Sub, LeftChunks[0], RightChunks[0], "", I), I);
+            Instruction *Borrow = CopyDebug(new ICmpInst(I, ICmpInst::ICMP_ULT, LeftChunks[0], RightChunks[0]), I);
+            Chunks.push_back(Low);
+            Chunks.push_back(CopyDebug(new SExtInst(Borrow, i32, "", I), I));
+            return true;
+          }
+          case Instruction::UDiv:
+          case Instruction::URem: {
+            if (!Narrow) break;
+            Chunks.push_back(CopyDebug(BinaryOperator::Create(cast<BinaryOperator>(I)->getOpcode(), LeftChunks[0], RightChunks[0], "", I), I));
+            Chunks.push_back(Zero);
+            return true;
+          }
+          case Instruction::LShr:
+          case Instruction::AShr:
+          case Instruction::Shl: {
+            if (ConstantInt *CI = dyn_cast<ConstantInt>(I->getOperand(1))) {
+              if (splitConstantShift(I, CI->getLimitedValue(), LeftChunks, Chunks))
+                return true;
+            }
+            break;
+          }
+          default: break;
+        }
+
+        // use a library call, no special optimization was found
         ensureFuncs();
-        Value *Low = NULL, *High = NULL;
         Function *F = NULL;
+        Instruction::BinaryOps LowOp = Instruction::BinaryOpsEnd;
         switch (I->getOpcode()) {
-          case Instruction::Add:  F = Add;  break;
-          case Instruction::Sub:  F = Sub;  break;
-          case Instruction::Mul:  F = Mul;  break;
+          case Instruction::Add:  F = Add;  LowOp = Instruction::Add; break;
+          case Instruction::Sub:  F = Sub;  LowOp = Instruction::Sub; break;
+          case Instruction::Mul:  F = Mul;  LowOp = Instruction::Mul; break;
           case Instruction::SDiv: F = SDiv; break;
           case Instruction::UDiv: F = UDiv; break;
           case Instruction::SRem: F = SRem; break;
           case Instruction::URem: F = URem; break;
           case Instruction::AShr: F = AShr; break;
-          case Instruction::LShr: {
-            if (ConstantInt *CI = dyn_cast<ConstantInt>(I->getOperand(1))) {
-              unsigned Shifts = CI->getZExtValue();
-              if (Shifts == 32) {
-                Low = LeftChunks[1];
-                High = Zero;
-                break;
-              }
-            }
-            F = LShr;
-            break;
-          }
-          case Instruction::Shl: {
-            if (ConstantInt *CI = dyn_cast<ConstantInt>(I->getOperand(1))) {
-              const APInt &Shifts = CI->getValue();
-              if (Shifts == 32) {
-                Low = Zero;
-                High = LeftChunks[0];
-                break;
-              }
-            }
-            F = Shl;
-            break;
-          }
+          case Instruction::LShr: F = LShr; break;
+          case Instruction::Shl:  F = Shl;  break;
           default: assert(0);
         }
-        if (F) {
-          // use a library call, no special optimization was found
-          SmallVector<Value *, 4> Args;
-          Args.push_back(LeftChunks[0]);
-          Args.push_back(LeftChunks[1]);
-          Args.push_back(RightChunks[0]);
-          Args.push_back(RightChunks[1]);
-          Low = CopyDebug(CallInst::Create(F, Args, "", I), I);
-          High = CopyDebug(CallInst::Create(GetHigh, "", I), I);
-        }
+        SmallVector<Value *, 4> Args;
+        Args.push_back(LeftChunks[0]);
+        Args.push_back(LeftChunks[1]);
+        Args.push_back(RightChunks[0]);
+        Args.push_back(RightChunks[1]);
+        CallInst *Low = cast<CallInst>(CopyDebug(CallInst::Create(F, Args, "", I), I));
+        CallInst *High = cast<CallInst>(CopyDebug(CallInst::Create(GetHigh, "", I), I));
+        HelperCalls.push_back({Low, High, LowOp});
         Chunks.push_back(Low);
         Chunks.push_back(High);
       } else {
@@ -623,6 +669,8 @@ bool ExpandI64::splitInst(Instruction *I) {
           // first combine 0 and 1. then combine that with 2, etc.
           Value *Combined = NULL;
           for (int i = 0; i < Num; i++) {
+            if (i > 0 && LeftChunks[i] == RightChunks[i])
+              continue; // identical chunks, e.g. zero high words, always match
             Value *Cmp = CopyDebug(new ICmpInst(I, PartPred, LeftChunks[i], RightChunks[i]), I);
             Combined = !Combined ? Cmp : CopyDebug(BinaryOperator::Create(CombineOp, Combined, Cmp, "", I), I);
           }
@@ -650,6 +698,14 @@ bool ExpandI64::splitInst(Instruction *I) {
           assert(T->isIntegerTy() && T->getIntegerBitWidth() % 32 == 0);
           int NumChunks = getNumChunks(T);
           assert(NumChunks >= 2);
+          if (NumChunks == 2 && LeftChunks[1] == RightChunks[1]) {
+            // The high words are the same (zero for two zero-extended values,
+            // for example), so only an unsigned compare of the low words is
+            // needed, whatever the signedness of the original compare.
+            Instruction *NewInst = CopyDebug(new ICmpInst(I, ICmpInst::getUnsignedPredicate(Pred), LeftChunks[0], RightChunks[0]), I);
+            I->replaceAllUsesWith(NewInst);
+            break;
+          }
           ICmpInst::Predicate StrictPred = Pred;
           ICmpInst::Predicate UnsignedPred = Pred;
           switch (Pred) {
@@ -775,6 +831,7 @@ bool ExpandI64::splitInst(Instruction *I) {
         assert(I->getType() == i64);
         ensureFuncs();
         H = CopyDebug(CallInst::Create(GetHigh, "", I), I);
+        HighChunks.push_back(H);
         Chunks.push_back(L);
         Chunks.push_back(H);
       } else {
@@ -797,6 +854,7 @@ bool ExpandI64::splitInst(Instruction *I) {
         L = CopyDebug(CallInst::Create(DtoILow, Args, "", I), I);
         H = CopyDebug(CallInst::Create(DtoIHigh, Args, "", I), I);
       }
+      HighChunks.push_back(H);
       Chunks.push_back(L);
       Chunks.push_back(H);
       break;
@@ -812,6 +870,7 @@ bool ExpandI64::splitInst(Instruction *I) {
         Args.push_back(I->getOperand(0));
         Instruction *L = CopyDebug(CallInst::Create(BDtoILow, Args, "", I), I);
         Instruction *H = CopyDebug(CallInst::Create(BDtoIHigh, Args, "", I), I);
+        HighChunks.push_back(H);
         Chunks.push_back(L);
         Chunks.push_back(H);
         break;
@@ -977,6 +1036,105 @@ bool ExpandI64::splitInst(Instruction *I) {
   return true;
 }
 
+bool ExpandI64::splitConstantShift(Instruction *I, unsigned Shifts,
+                                   const ChunksVec &LeftChunks,
+                                   ChunksVec &Chunks) {
+  if (Shifts >= 64)
+    return false; // poison; leave it to the library call
+
+  Type *i32 = Type::getInt32Ty(I->getContext());
+  Value *Zero = Constant::getNullValue(i32);
+  Value *Lo = LeftChunks[0], *Hi = LeftChunks[1];
+  unsigned Fraction = Shifts % 32;
+
+  // Emits Op on a chunk, folding it away where possible.
+  auto Emit = [&](Instruction::BinaryOps Op, Value *L, unsigned Amount) -> Value* {
+    Value *R = ConstantInt::get(i32, Amount);
+    if (Value *V = SimplifyBinOp(Op, L, R, *DL))
+      return V;
+    return CopyDebug(BinaryOperator::Create(Op, L, R, "", I), I);
+  };
+  auto Or = [&](Value *L, Value *R) -> Value* {
+    if (Value *V = SimplifyBinOp(Instruction::Or, L, R, *DL))
+      return V;
+    return CopyDebug(BinaryOperator::Create(Instruction::Or, L, R, "", I), I);
+  };
+
+  Value *Low, *High;
+  switch (I->getOpcode()) {
+    case Instruction::Shl: {
+      if (Shifts >= 32) {
+        Low = Zero;
+        High = Emit(Instruction::Shl, Lo, Shifts - 32);
+      } else if (Fraction == 0) {
+        Low = Lo;
+        High = Hi;
+      } else {
+        Low = Emit(Instruction::Shl, Lo, Fraction);
+        High = Or(Emit(Instruction::Shl, Hi, Fraction),
+                  Emit(Instruction::LShr, Lo, 32 - Fraction));
+      }
+      break;
+    }
+    case Instruction::LShr:
+    case Instruction::AShr: {
+      Instruction::BinaryOps Op = cast<BinaryOperator>(I)->getOpcode();
+      if (Shifts >= 32) {
+        Low = Emit(Op, Hi, Shifts - 32);
+        High = Op == Instruction::AShr ? Emit(Instruction::AShr, Hi, 31) : Zero;
+      } else if (Fraction == 0) {
+        Low = Lo;
+        High = Hi;
+      } else {
+        Low = Or(Emit(Instruction::LShr, Lo, Fraction),
+                 Emit(Instruction::Shl, Hi, 32 - Fraction));
+        High = Emit(Op, Hi, Fraction);
+      }
+      break;
+    }
+    default: llvm_unreachable("not a shift");
+  }
+  if (High != Lo && High != Hi)
+    if (Instruction *HighInst = dyn_cast<Instruction>(High))
+      HighChunks.push_back(HighInst);
+  Chunks.push_back(Low);
+  Chunks.push_back(High);
+  return true;
+}
+
+void ExpandI64::removeUnusedHighChunks() {
+  // High chunks which are plain computations, or calls which only read the
+  // high word, can simply be dropped, and so can what only they used.
+  SmallSetVector<Instruction *, 16> Worklist(HighChunks.begin(), HighChunks.end());
+  HighChunks.clear();
+  while (!Worklist.empty()) {
+    Instruction *H = Worklist.pop_back_val();
+    if (!H->use_empty())
+      continue;
+    if (!isa<CallInst>(H) && !isInstructionTriviallyDead(H))
+      continue;
+    for (Value *Op : H->operands())
+      if (Instruction *OpInst = dyn_cast<Instruction>(Op))
+        if (!OpInst->mayHaveSideEffects())
+          Worklist.insert(OpInst);
+    H->eraseFromParent();
+  }
+
+  // Library calls whose high word is unused only need their low word, which
+  // for some operations is just the 32-bit operation on the low words.
+  for (HelperCall &HC : HelperCalls) {
+    if (!HC.High->use_empty())
+      continue;
+    HC.High->eraseFromParent();
+    if (HC.LowOp == Instruction::BinaryOpsEnd)
+      continue;
+    Instruction *NewLow = CopyDebug(BinaryOperator::Create(HC.LowOp, HC.Low->getArgOperand(0), HC.Low->getArgOperand(2), "", HC.Low), HC.Low);
+    HC.Low->replaceAllUsesWith(NewLow);
+    HC.Low->eraseFromParent();
+  }
+  HelperCalls.clear();
+}
+
 ChunksVec ExpandI64::getChunks(Value *V, bool AllowUnreachable) {
   assert(isIllegal(V->getType()));
 
@@ -1211,6 +1369,8 @@ bool ExpandI64::runOnModule(Module &M) {
     }
     PhiBlockChanges.clear();
 
+    removeUnusedHighChunks();
+
     // We only visited blocks found by a DFS walk from the entry, so we haven't
     // visited any unreachable blocks, and they may still contain illegal
     // instructions at this point. Being unreachable, they can simply be deleted.
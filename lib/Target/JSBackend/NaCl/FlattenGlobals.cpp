@@ -40,6 +40,11 @@
 // A CompoundElement is a unnamed, packed struct containing only
 // SimpleElements.
 //
+// Globals are flattened one at a time: the flattened initializer is installed
+// as soon as it is built, and the original initializer is then destroyed, so
+// that only one global's byte buffer and constants are live at any point.
+// Globals which are already in normal form (plain i8 arrays) are left alone.
+//
 // Limitations:
 //
 // LLVM IR allows ConstantExprs that calculate the difference between
@@ -49,7 +54,7 @@
 //
 //===----------------------------------------------------------------------===//
 
-#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SetVector.h"
 #include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/IR/Constants.h"
@@ -63,38 +68,47 @@
 
 using namespace llvm;
 
-namespace {
+// Destroys a constant which is no longer used, along with the aggregates and
+// ConstantExprs which only it used. Uniqued constants otherwise stay alive
+// until the LLVMContext is destroyed, even when nothing refers to them.
+static void destroyDeadConstant(Constant *C) {
+  SmallSetVector<Constant *, 16> Worklist;
+  Worklist.insert(C);
+  while (!Worklist.empty()) {
+    Constant *C = Worklist.pop_back_val();
+    if (!C->use_empty() ||
+        !(isa<ConstantAggregate>(C) || isa<ConstantExpr>(C)))
+      continue;
+    for (Value *Op : C->operands())
+      Worklist.insert(cast<Constant>(Op));
+    C->destroyConstant();
+  }
+}
 
-  // Defines a (non-constant) handle that records a use of a
-  // constant. Used to make sure a relocation, within flattened global
-  // variable initializers, does not get destroyed when method
-  // removeDeadConstantUsers gets called. For simplicity, rather than
-  // defining a new (non-constant) construct, we use a return
-  // instruction as the handle.
-  typedef ReturnInst RelocUserType;
+// Returns whether the global variable is already in the normal form, so that
+// there is nothing to flatten.
+static bool isFlattened(GlobalVariable *Global) {
+  ArrayType *Ty = dyn_cast<ArrayType>(Global->getValueType());
+  if (!Ty || !Ty->getElementType()->isIntegerTy(8))
+    return false;
+  if (!Global->hasInitializer())
+    return true;
+  Constant *Init = Global->getInitializer();
+  return isa<ConstantDataArray>(Init) || isa<ConstantAggregateZero>(Init);
+}
 
-  // Define map from a relocation, appearing in the flattened global variable
-  // initializers, to it's corresponding use handle.
-  typedef DenseMap<Constant*, RelocUserType*> RelocMapType;
+namespace {
 
   // Define the list to hold the list of global variables being flattened.
   struct FlattenedGlobal;
   typedef std::vector<FlattenedGlobal*> FlattenedGlobalsVectorType;
 
-  // Returns the corresponding relocation, for the given user handle.
-  Constant *getRelocUseConstant(RelocUserType *RelocUser) {
-    return cast<Constant>(RelocUser->getReturnValue());
-  }
-
   // The state associated with flattening globals of a module.
   struct FlattenGlobalsState {
     /// The module being flattened.
     Module &M;
     /// The data layout to be used.
     DataLayout DL;
-    /// The relocations (within the original global variable initializers)
-    /// that must be kept.
-    RelocMapType RelocMap;
     /// The list of global variables that are being flattened.
     FlattenedGlobalsVectorType FlattenedGlobalsVector;
     /// True if the module was modified during the "flatten globals" pass.
@@ -107,7 +121,7 @@ namespace {
     unsigned PtrSize;
 
     explicit FlattenGlobalsState(Module &M)
-        : M(M), DL(&M), RelocMap(),
+        : M(M), DL(&M),
           Modified(false),
           ByteType(Type::getInt8Ty(M.getContext())),
           IntPtrType(DL.getIntPtrType(M.getContext())),
@@ -115,45 +129,19 @@ namespace {
     {}
 
     ~FlattenGlobalsState() {
-      // Remove added user handles.
-      for (RelocMapType::iterator
-               I = RelocMap.begin(), E = RelocMap.end(); I != E; ++I) {
-        delete I->second;
-      }
       // Remove flatteners for global varaibles.
       DeleteContainerPointers(FlattenedGlobalsVector);
     }
 
     /// Collect Global variables whose initializers should be
-    /// flattened.  Creates corresponding flattened initializers (if
-    /// applicable), and creates uninitialized replacement global
-    /// variables.
+    /// flattened.  Creates replacement global variables with the
+    /// corresponding flattened initializers, and removes the
+    /// original initializers.
     void flattenGlobalsWithInitializers();
 
-    /// Remove initializers from original global variables, and
-    /// then remove the portions of the initializers that are
-    /// no longer used.
-    void removeDeadInitializerConstants();
-
     // Replace the original global variables with their flattened
     // global variable counterparts.
     void replaceGlobalsWithFlattenedGlobals();
-
-    // Builds and installs initializers for flattened global
-    // variables, based on the flattened initializers of the
-    // corresponding original global variables.
-    void installFlattenedGlobalInitializers();
-
-    // Returns the user handle associated with the reloc, so that it
-    // won't be deleted during the flattening process.
-    RelocUserType *getRelocUserHandle(Constant *Reloc) {
-      RelocUserType *RelocUser = RelocMap[Reloc];
-      if (RelocUser == NULL) {
-        RelocUser = ReturnInst::Create(M.getContext(), Reloc);
-        RelocMap[Reloc] = RelocUser;
-      }
-      return RelocUser;
-    }
   };
 
   // A FlattenedConstant represents a global variable initializer that
@@ -171,21 +159,13 @@ namespace {
     class Reloc {
     private:
       unsigned RelOffset;  // Offset at which the relocation is to be applied.
-      RelocUserType *RelocUser;
+      Constant *RelocUse;
    public:
 
       unsigned getRelOffset() const { return RelOffset; }
-      Constant *getRelocUse() const { return getRelocUseConstant(RelocUser); }
-      Reloc(FlattenGlobalsState &State, unsigned RelOffset, Constant *NewVal)
-          : RelOffset(RelOffset), RelocUser(State.getRelocUserHandle(NewVal)) {}
-
-      explicit Reloc(const Reloc &R)
-          : RelOffset(R.RelOffset), RelocUser(R.RelocUser) {}
-
-      void operator=(const Reloc &R) {
-        RelOffset = R.RelOffset;
-        RelocUser = R.RelocUser;
-      }
+      Constant *getRelocUse() const { return RelocUse; }
+      Reloc(unsigned RelOffset, Constant *NewVal)
+          : RelOffset(RelOffset), RelocUse(NewVal) {}
     };
     typedef SmallVector<Reloc, 10> RelocArray;
     RelocArray Relocs;
@@ -243,9 +223,6 @@ namespace {
     GlobalVariable *NewGlobal;
     // True if Global has an initializer.
     bool HasInitializer;
-    // The flattened initializer, if the initializer would not just be
-    // filled with zeroes.
-    FlattenedConstant *FlatConst;
     // The type of GlobalType, when used in an initializer.
     Type *GlobalType;
     // The size of the initializer.
@@ -256,20 +233,22 @@ namespace {
           Global(Global),
           NewGlobal(NULL),
           HasInitializer(Global->hasInitializer()),
-          FlatConst(NULL),
           GlobalType(Global->getType()->getPointerElementType()),
           Size(GlobalType->isSized()
                ? getDataLayout().getTypeAllocSize(GlobalType) : 0) {
       Type *NewType = NULL;
+      Constant *NewInit = NULL;
       if (HasInitializer) {
         if (Global->getInitializer()->isNullValue()) {
           // Special case of NullValue. As an optimization, for large
           // BSS variables, avoid allocating a buffer that would only be filled
           // with zeros.
           NewType = ArrayType::get(getByteType(), Size);
+          NewInit = ConstantAggregateZero::get(NewType);
         } else {
-          FlatConst = new FlattenedConstant(State, Global->getInitializer());
-          NewType = FlatConst->getAsNormalFormType();
+          FlattenedConstant FlatConst(State, Global->getInitializer());
+          NewType = FlatConst.getAsNormalFormType();
+          NewInit = FlatConst.getAsNormalFormConstant();
         }
       } else {
         NewType = ArrayType::get(getByteType(), Size);
@@ -285,10 +264,10 @@ namespace {
                                 getPrefTypeAlignment(GlobalType));
       NewGlobal->setExternallyInitialized(Global->isExternallyInitialized());
       NewGlobal->takeName(Global);
-    }
-
-    ~FlattenedGlobal() {
-      delete FlatConst;
+      if (HasInitializer) {
+        NewGlobal->setInitializer(NewInit);
+        removeOriginalInitializer();
+      }
     }
 
     const DataLayout &getDataLayout() const { return State.DL; }
@@ -297,10 +276,12 @@ namespace {
 
     Type *getByteType() const { return State.ByteType; }
 
-    // Removes the original initializer from the global variable to be
-    // flattened, if applicable.
+    // Removes the original initializer from the global variable being
+    // flattened, and destroys the parts of it which are no longer used.
     void removeOriginalInitializer() {
-      if (HasInitializer) Global->setInitializer(NULL);
+      Constant *Init = Global->getInitializer();
+      Global->setInitializer(NULL);
+      destroyDeadConstant(Init);
     }
 
     // Replaces the original global variable with the corresponding
@@ -311,21 +292,6 @@ namespace {
       Global->eraseFromParent();
     }
 
-    // Installs flattened initializers to the corresponding flattened
-    // global variable.
-    void installFlattenedInitializer() {
-      if (HasInitializer) {
-        Constant *NewInit = NULL;
-        if (FlatConst == NULL) {
-          // Special case of NullValue.
-          NewInit = ConstantAggregateZero::get(ArrayType::get(getByteType(),
-                                                              Size));
-        } else {
-          NewInit = FlatConst->getAsNormalFormConstant();
-        }
-        NewGlobal->setInitializer(NewInit);
-      }
-    }
   };
 
   class FlattenGlobals : public ModulePass {
@@ -427,8 +393,7 @@ void FlattenedConstant::putAtDest(Constant *Val, uint8_t *Dest) {
             NewVal, ConstantInt::get(getIntPtrType(), Offset,
                                      /* isSigned= */ true));
       }
-      Reloc NewRel(State, Dest - Buf, NewVal);
-      Relocs.push_back(NewRel);
+      Relocs.push_back(Reloc(Dest - Buf, NewVal));
     } else {
       memcpy(Dest, &Offset, ValSize);
     }
@@ -497,25 +462,17 @@ void FlattenGlobalsState::flattenGlobalsWithInitializers() {
     if (Global->hasAppendingLinkage())
       continue;
     Modified = true;
+    if (isFlattened(Global)) {
+      // Keep the global as it is; just give it the same alignment a
+      // flattened copy would get.
+      if (Global->getAlignment() == 0)
+        Global->setAlignment(DL.getPrefTypeAlignment(Global->getValueType()));
+      continue;
+    }
     FlattenedGlobalsVector.push_back(new FlattenedGlobal(*this, Global));
   }
 }
 
-void FlattenGlobalsState::removeDeadInitializerConstants() {
-  // Detach original initializers.
-  for (FlattenedGlobalsVectorType::iterator
-           I = FlattenedGlobalsVector.begin(), E = FlattenedGlobalsVector.end();
-       I != E; ++I) {
-    (*I)->removeOriginalInitializer();
-  }
-  // Do cleanup of old initializers.
-  for (RelocMapType::iterator I = RelocMap.begin(), E = RelocMap.end();
-       I != E; ++I) {
-    getRelocUseConstant(I->second)->removeDeadConstantUsers();
-  }
-
-}
-
 void FlattenGlobalsState::replaceGlobalsWithFlattenedGlobals() {
   for (FlattenedGlobalsVectorType::iterator
            I = FlattenedGlobalsVector.begin(), E = FlattenedGlobalsVector.end();
@@ -524,20 +481,10 @@ void FlattenGlobalsState::replaceGlobalsWithFlattenedGlobals() {
   }
 }
 
-void FlattenGlobalsState::installFlattenedGlobalInitializers() {
-  for (FlattenedGlobalsVectorType::iterator
-           I = FlattenedGlobalsVector.begin(), E = FlattenedGlobalsVector.end();
-       I != E; ++I) {
-    (*I)->installFlattenedInitializer();
-  }
-}
-
 bool FlattenGlobals::runOnModule(Module &M) {
   FlattenGlobalsState State(M);
   State.flattenGlobalsWithInitializers();
-  State.removeDeadInitializerConstants();
   State.replaceGlobalsWithFlattenedGlobals();
-  State.installFlattenedGlobalInitializers();
   return State.Modified;
 }
 
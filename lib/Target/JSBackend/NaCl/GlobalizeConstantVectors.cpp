@@ -14,22 +14,49 @@
 // The FlattenGlobals pass can be used to further simplify the globals
 // that this pass creates.
 //
+// With -globalize-constant-vectors-locals, constant vectors are instead
+// rebuilt once per function at its entry: splats as an insertelement followed
+// by a shufflevector, and other small vectors as a chain of insertelements
+// (which the JS backend emits as SIMD splats and constructors). Only
+// non-splat vectors larger than -globalize-constant-vectors-max-local-size
+// bytes are still loaded from globals.
+//
 //===----------------------------------------------------------------------===//
 
 #include "llvm/ADT/DenseMap.h"
 #include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/Statistic.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/InstIterator.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/Module.h"
 #include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
 #include "llvm/Transforms/NaCl.h"
 #include <utility>
 #include <vector>
 
 using namespace llvm;
 
+#define DEBUG_TYPE "globalize-constant-vectors"
+
+STATISTIC(NumGlobalized, "Number of constant vectors loaded from globals");
+STATISTIC(NumRebuilt, "Number of constant vectors rebuilt at function entry");
+
+// Also read by the JS backend, which only adds this pass in this mode.
+cl::opt<bool> GlobalizeLocalConstantVectors(
+    "globalize-constant-vectors-locals",
+    cl::desc("Rebuild splats and small constant vectors at function entry "
+             "instead of loading them from globals"),
+    cl::init(false));
+
+static cl::opt<unsigned> MaxLocalConstantVectorSize(
+    "globalize-constant-vectors-max-local-size",
+    cl::desc("Size in bytes of the largest non-splat constant vector that "
+             "-globalize-constant-vectors-locals rebuilds at function entry"),
+    cl::init(16));
+
 namespace {
 // Must be a ModulePass since it adds globals.
 class GlobalizeConstantVectors : public ModulePass {
@@ -50,6 +77,8 @@ private:
   typedef DenseMap<Constant *, GlobalVariable *> GlobalizedConstants;
   const DataLayout *DL;
 
+  bool isRebuiltLocally(Constant *C) const;
+  Value *rebuildConstantVector(Constant *C, Instruction *InsertPt) const;
   void findConstantVectors(const Function &F, Constants &Cs) const;
   void createGlobalConstantVectors(Module &M, const FunctionConstantList &FCs,
                                    GlobalizedConstants &GCs) const;
@@ -65,12 +94,57 @@ INITIALIZE_PASS(GlobalizeConstantVectors, "globalize-constant-vectors",
                 "Replace constant vector operands with equivalent loads", false,
                 false)
 
+bool GlobalizeConstantVectors::isRebuiltLocally(Constant *C) const {
+  if (!GlobalizeLocalConstantVectors)
+    return false;
+  // Scalar floats do not keep NaN payloads, so such vectors stay in memory.
+  for (unsigned I = 0, E = C->getType()->getVectorNumElements(); I != E; ++I)
+    if (ConstantFP *CFP = dyn_cast<ConstantFP>(C->getAggregateElement(I)))
+      if (CFP->isNaN())
+        return false;
+  return C->getSplatValue() ||
+         DL->getTypeStoreSize(C->getType()) <= MaxLocalConstantVectorSize;
+}
+
+Value *
+GlobalizeConstantVectors::rebuildConstantVector(Constant *C,
+                                                Instruction *InsertPt) const {
+  VectorType *VT = cast<VectorType>(C->getType());
+  Type *I32 = Type::getInt32Ty(C->getContext());
+  Value *Vec = UndefValue::get(VT);
+  if (Constant *Splat = C->getSplatValue()) {
+    Vec = InsertElementInst::Create(Vec, Splat, ConstantInt::get(I32, 0), Name,
+                                    InsertPt);
+    return new ShuffleVectorInst(
+        Vec, UndefValue::get(VT),
+        ConstantAggregateZero::get(VectorType::get(I32, VT->getNumElements())),
+        Name, InsertPt);
+  }
+  for (unsigned I = 0, E = VT->getNumElements(); I != E; ++I)
+    Vec = InsertElementInst::Create(Vec, C->getAggregateElement(I),
+                                    ConstantInt::get(I32, I), Name, InsertPt);
+  return Vec;
+}
+
+// Shuffle masks must stay constant. When vectors are rebuilt locally, shift
+// amounts are left alone too, since the JS backend shifts by a constant splat
+// as an immediate scalar.
+static bool keepsConstantOperand(const User *U, unsigned OpNo) {
+  if (isa<ShuffleVectorInst>(U))
+    return OpNo == 2;
+  const Instruction *I = dyn_cast<Instruction>(U);
+  return GlobalizeLocalConstantVectors && I &&
+         Instruction::isShift(I->getOpcode()) && OpNo == 1;
+}
+
 void GlobalizeConstantVectors::findConstantVectors(const Function &F,
                                                    Constants &Cs) const {
   for (const_inst_iterator II = inst_begin(F), IE = inst_end(F); II != IE;
        ++II) {
     for (User::const_op_iterator OI = II->op_begin(), OE = II->op_end();
          OI != OE; ++OI) {
+      if (keepsConstantOperand(&*II, OI->getOperandNo()))
+        continue;
       Value *V = OI->get();
       if (isa<ConstantVector>(V) || isa<ConstantDataVector>(V) ||
           isa<ConstantAggregateZero>(V))
@@ -91,6 +165,8 @@ void GlobalizeConstantVectors::createGlobalConstantVectors(
       Constant *C = *CI;
       if (GCs.find(C) != GCs.end())
         continue; // The vector has already been globalized.
+      if (isRebuiltLocally(C))
+        continue;
       GlobalVariable *GV =
           new GlobalVariable(M, C->getType(), /* isConstant= */ true,
                              GlobalValue::InternalLinkage, C, Name);
@@ -110,11 +186,18 @@ void GlobalizeConstantVectors::materializeConstantVectors(
   for (Constants::const_iterator CI = Cs.begin(), CE = Cs.end(); CI != CE;
        ++CI) {
     Constant *C = *CI;
-    GlobalizedConstants::const_iterator GVI = GCs.find(C);
-    assert(GVI != GCs.end());
-    GlobalVariable *GV = GVI->second;
-    LoadInst *MaterializedGV = new LoadInst(GV, Name, /* isVolatile= */ false,
-                                            GV->getAlignment(), FirstInst);
+    Value *MaterializedGV;
+    if (isRebuiltLocally(C)) {
+      MaterializedGV = rebuildConstantVector(C, FirstInst);
+      ++NumRebuilt;
+    } else {
+      GlobalizedConstants::const_iterator GVI = GCs.find(C);
+      assert(GVI != GCs.end());
+      GlobalVariable *GV = GVI->second;
+      MaterializedGV = new LoadInst(GV, Name, /* isVolatile= */ false,
+                                    GV->getAlignment(), FirstInst);
+      ++NumGlobalized;
+    }
 
     // Find users of the constant vector.
     typedef SmallVector<User *, 64> UserList;
@@ -141,7 +224,8 @@ void GlobalizeConstantVectors::materializeConstantVectors(
       User *U = *UI;
       for (User::op_iterator OI = U->op_begin(), OE = U->op_end(); OI != OE;
            ++OI)
-        if (dyn_cast<Constant>(*OI) == C)
+        if (dyn_cast<Constant>(*OI) == C &&
+            !keepsConstantOperand(U, OI->getOperandNo()))
           // The current operand is a use of the constant vector, replace it
           // with the materialized one.
           *OI = MaterializedGV;
@@ -0,0 +1,393 @@
+//===- NarrowI64.cpp - Narrow i64 operations whose values fit in 32 bits --===//
+//
+//                     The LLVM Compiler Infrastructure
+//
+// This file is distributed under the University of Illinois Open Source
+// License. See LICENSE.TXT for details.
+//
+//===------------------------------------------------------------------===//
+//
+// This pass runs before ExpandI64 and rewrites i64 operations which provably
+// do not need 64 bits, so that they never reach the chunked lowering (and the
+// library calls it makes for arithmetic):
+//
+//  * Arithmetic, compares and conversions whose operands and result fit in
+//    32 bits, according to known bits and LazyValueInfo ranges, are done in
+//    i32 and then extended back.
+//  * Arithmetic which only feeds a truncation to 32 bits or less is done on
+//    truncated operands, as the high bits do not matter.
+//  * An add, sub or mul of 32-bit values whose result fits in 53 bits, and
+//    which is only converted to floating point, is done in double, where it
+//    is exact.
+//
+//===------------------------------------------------------------------===//
+
+#define DEBUG_TYPE "narrow-i64"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/Analysis/LazyValueInfo.h"
+#include "llvm/Analysis/ValueTracking.h"
+#include "llvm/IR/ConstantRange.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/DataLayout.h"
+#include "llvm/IR/Function.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IR/ValueHandle.h"
+#include "llvm/Pass.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/KnownBits.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/NaCl.h"
+#include "llvm/Transforms/Utils/Local.h"
+
+using namespace llvm;
+
+STATISTIC(NumNarrowed, "Number of i64 operations narrowed");
+
+static cl::opt<bool> NarrowReport(
+    "emscripten-narrow-i64-report",
+    cl::desc("Print how many i64 operations were narrowed in each function"),
+    cl::init(false));
+
+namespace {
+
+  class NarrowI64 : public FunctionPass {
+    const DataLayout *DL;
+    LazyValueInfo *LVI;
+    Type *i32, *i64;
+
+    // Returns the unsigned range V can have at the point of I.
+    ConstantRange getRange(Value *V, Instruction *I);
+
+    bool fitsUnsigned32(Value *V, Instruction *I) {
+      return getRange(V, I).getUnsignedMax().isIntN(32);
+    }
+    bool fitsSigned32(Value *V, Instruction *I) {
+      ConstantRange CR = getRange(V, I);
+      return CR.getSignedMin().isSignedIntN(32) &&
+             CR.getSignedMax().isSignedIntN(32);
+    }
+
+    // Returns V truncated to Ty, looking through extensions and, for
+    // operations whose low bits only depend on the low bits of their
+    // operands, narrowing the operation itself.
+    Value *getTruncated(Value *V, Type *Ty, Instruction *InsertPt,
+                        unsigned &Count, unsigned Depth = 0);
+
+    Value *narrowBinary(BinaryOperator *BO, unsigned &Count);
+    Value *narrowICmp(ICmpInst *Cmp, unsigned &Count);
+    Value *narrowToFP(CastInst *Cast, unsigned &Count);
+    Value *narrowTrunc(TruncInst *Trunc, unsigned &Count);
+
+  public:
+    static char ID;
+    NarrowI64() : FunctionPass(ID) {
+      initializeNarrowI64Pass(*PassRegistry::getPassRegistry());
+    }
+
+    void getAnalysisUsage(AnalysisUsage &AU) const override {
+      AU.addRequired<LazyValueInfoWrapperPass>();
+      AU.setPreservesCFG();
+    }
+
+    bool runOnFunction(Function &F) override;
+  };
+}
+
+char NarrowI64::ID = 0;
+INITIALIZE_PASS_BEGIN(NarrowI64, "narrow-i64",
+                      "Narrow i64 operations whose values fit in 32 bits",
+                      false, false)
+INITIALIZE_PASS_DEPENDENCY(LazyValueInfoWrapperPass)
+INITIALIZE_PASS_END(NarrowI64, "narrow-i64",
+                    "Narrow i64 operations whose values fit in 32 bits",
+                    false, false)
+
+// Utilities
+
+static bool isI64(Value *V) {
+  return V->getType()->isIntegerTy(64);
+}
+
+static ConstantRange getKnownBitsRange(const KnownBits &Known) {
+  APInt Lower = Known.One, Upper = ~Known.Zero + 1;
+  if (Lower == Upper)
+    return ConstantRange(Known.getBitWidth(), /*isFullSet=*/true);
+  return ConstantRange(Lower, Upper);
+}
+
+// Whether an integer with the given range is exactly representable as a
+// double.
+static bool fitsDouble(const ConstantRange &CR) {
+  return CR.getSignedMin().isSignedIntN(54) &&
+         CR.getSignedMax().isSignedIntN(54);
+}
+
+ConstantRange NarrowI64::getRange(Value *V, Instruction *I) {
+  ConstantRange CR = getKnownBitsRange(computeKnownBits(V, *DL, 0, nullptr, I));
+  if (CR.isFullSet() || !CR.getUnsignedMax().isIntN(32))
+    CR = CR.intersectWith(LVI->getConstantRange(V, I->getParent(), I));
+  return CR;
+}
+
+Value *NarrowI64::getTruncated(Value *V, Type *Ty, Instruction *InsertPt,
+                               unsigned &Count, unsigned Depth) {
+  IRBuilder<> Builder(InsertPt);
+  if (Constant *C = dyn_cast<Constant>(V))
+    return ConstantExpr::getTrunc(C, Ty);
+  if (isa<ZExtInst>(V) || isa<SExtInst>(V)) {
+    Value *Src = cast<CastInst>(V)->getOperand(0);
+    unsigned SrcBits = Src->getType()->getIntegerBitWidth();
+    unsigned DestBits = Ty->getIntegerBitWidth();
+    if (SrcBits == DestBits)
+      return Src;
+    if (SrcBits > DestBits)
+      return Builder.CreateTrunc(Src, Ty);
+    return isa<ZExtInst>(V) ? Builder.CreateZExt(Src, Ty)
+                            : Builder.CreateSExt(Src, Ty);
+  }
+  // The low bits of these only depend on the low bits of the operands. If
+  // nothing else uses the wide value, narrow it as well.
+  BinaryOperator *BO = dyn_cast<BinaryOperator>(V);
+  if (BO && BO->hasOneUse() && Depth < 6) {
+    switch (BO->getOpcode()) {
+      case Instruction::Add:
+      case Instruction::Sub:
+      case Instruction::Mul:
+      case Instruction::And:
+      case Instruction::Or:
+      case Instruction::Xor: {
+        Value *L = getTruncated(BO->getOperand(0), Ty, BO, Count, Depth + 1);
+        Value *R = getTruncated(BO->getOperand(1), Ty, BO, Count, Depth + 1);
+        Count++;
+        return Builder.CreateBinOp(BO->getOpcode(), L, R, BO->getName());
+      }
+      default: break;
+    }
+  }
+  return Builder.CreateTrunc(V, Ty);
+}
+
+Value *NarrowI64::narrowBinary(BinaryOperator *BO, unsigned &Count) {
+  Value *L = BO->getOperand(0), *R = BO->getOperand(1);
+  ConstantRange LR = getRange(L, BO), RR = getRange(R, BO);
+  bool LU = LR.getUnsignedMax().isIntN(32), RU = RR.getUnsignedMax().isIntN(32);
+  bool LS = fitsSigned32(L, BO), RS = fitsSigned32(R, BO);
+
+  // Whether to zero or sign extend the narrow result, if it is valid at all.
+  enum { None, Zero, Sign } Ext = None;
+  switch (BO->getOpcode()) {
+    case Instruction::Add:
+    case Instruction::Sub:
+    case Instruction::Mul: {
+      ConstantRange Result =
+          BO->getOpcode() == Instruction::Add ? LR.add(RR) :
+          BO->getOpcode() == Instruction::Sub ? LR.sub(RR) :
+                                                LR.multiply(RR);
+      if (LU && RU && Result.getUnsignedMax().isIntN(32))
+        Ext = Zero;
+      else if (LS && RS && Result.getSignedMin().isSignedIntN(32) &&
+               Result.getSignedMax().isSignedIntN(32))
+        Ext = Sign;
+      break;
+    }
+    case Instruction::And:
+      // The high bits of the result are clear if either side's are.
+      if (LU || RU)
+        Ext = Zero;
+      else if (LS && RS)
+        Ext = Sign;
+      break;
+    case Instruction::Or:
+    case Instruction::Xor:
+      if (LU && RU)
+        Ext = Zero;
+      else if (LS && RS)
+        Ext = Sign;
+      break;
+    case Instruction::UDiv:
+    case Instruction::URem:
+      if (LU && RU)
+        Ext = Zero;
+      break;
+    case Instruction::SDiv:
+    case Instruction::SRem:
+      // INT32_MIN / -1 overflows in 32 bits, but not in 64.
+      if (LS && RS && (!LR.contains(APInt::getSignedMinValue(32).sext(64)) ||
+                       !RR.contains(APInt::getAllOnesValue(64))))
+        Ext = Sign;
+      break;
+    case Instruction::Shl:
+      if (RR.getUnsignedMax().ult(32) && LU &&
+          LR.shl(RR).getUnsignedMax().isIntN(32))
+        Ext = Zero;
+      break;
+    case Instruction::LShr:
+      if (RR.getUnsignedMax().ult(32) && LU)
+        Ext = Zero;
+      break;
+    case Instruction::AShr:
+      if (RR.getUnsignedMax().ult(32) && LS)
+        Ext = Sign;
+      break;
+    default: break;
+  }
+  if (Ext == None)
+    return nullptr;
+
+  IRBuilder<> Builder(BO);
+  Value *NL = getTruncated(L, i32, BO, Count);
+  Value *NR = getTruncated(R, i32, BO, Count);
+  Value *Narrow = Builder.CreateBinOp(BO->getOpcode(), NL, NR, BO->getName());
+  Count++;
+  return Ext == Zero ? Builder.CreateZExt(Narrow, i64)
+                     : Builder.CreateSExt(Narrow, i64);
+}
+
+Value *NarrowI64::narrowICmp(ICmpInst *Cmp, unsigned &Count) {
+  Value *L = Cmp->getOperand(0), *R = Cmp->getOperand(1);
+  ICmpInst::Predicate Pred = Cmp->getPredicate();
+  if (fitsUnsigned32(L, Cmp) && fitsUnsigned32(R, Cmp)) {
+    // Both are non-negative, so signed and unsigned orderings agree.
+    Pred = ICmpInst::getUnsignedPredicate(Pred);
+  } else if (!fitsSigned32(L, Cmp) || !fitsSigned32(R, Cmp)) {
+    return nullptr;
+  }
+  // Sign extension preserves both the signed and the unsigned ordering, so
+  // the predicate can be kept as it is.
+  IRBuilder<> Builder(Cmp);
+  Value *NL = getTruncated(L, i32, Cmp, Count);
+  Value *NR = getTruncated(R, i32, Cmp, Count);
+  Count++;
+  return Builder.CreateICmp(Pred, NL, NR, Cmp->getName());
+}
+
+Value *NarrowI64::narrowToFP(CastInst *Cast, unsigned &Count) {
+  Value *Op = Cast->getOperand(0);
+  bool Signed = Cast->getOpcode() == Instruction::SIToFP;
+  IRBuilder<> Builder(Cast);
+
+  // The value itself fits in 32 bits.
+  if (fitsUnsigned32(Op, Cast)) {
+    Count++;
+    return Builder.CreateUIToFP(getTruncated(Op, i32, Cast, Count),
+                                Cast->getType(), Cast->getName());
+  }
+  if (Signed && fitsSigned32(Op, Cast)) {
+    Count++;
+    return Builder.CreateSIToFP(getTruncated(Op, i32, Cast, Count),
+                                Cast->getType(), Cast->getName());
+  }
+
+  // Arithmetic on 32-bit values, whose result is exact in a double.
+  BinaryOperator *BO = dyn_cast<BinaryOperator>(Op);
+  if (!BO || !BO->hasOneUse())
+    return nullptr;
+  Instruction::BinaryOps FOp;
+  switch (BO->getOpcode()) {
+    case Instruction::Add: FOp = Instruction::FAdd; break;
+    case Instruction::Sub: FOp = Instruction::FSub; break;
+    case Instruction::Mul: FOp = Instruction::FMul; break;
+    default: return nullptr;
+  }
+  // The double computes the exact result, so it is the exact result that
+  // must be bounded, not the i64 one, which may have wrapped around. The
+  // operand ranges are widened to 128 bits, where the operation cannot wrap.
+  bool OpUnsigned[2];
+  ConstantRange OpRange[2] = {ConstantRange(128), ConstantRange(128)};
+  for (unsigned i = 0; i < 2; i++) {
+    Value *V = BO->getOperand(i);
+    OpUnsigned[i] = fitsUnsigned32(V, BO);
+    if (!OpUnsigned[i] && !fitsSigned32(V, BO))
+      return nullptr;
+    ConstantRange CR = getRange(V, BO);
+    OpRange[i] = OpUnsigned[i] ? CR.zeroExtend(128) : CR.signExtend(128);
+  }
+  ConstantRange Exact =
+      FOp == Instruction::FAdd ? OpRange[0].add(OpRange[1]) :
+      FOp == Instruction::FSub ? OpRange[0].sub(OpRange[1]) :
+                                 OpRange[0].multiply(OpRange[1]);
+  // Within 53 bits the i64 operation does not wrap either, so its value is
+  // the exact result; but uitofp must not see a negative one.
+  if (!fitsDouble(Exact) || (!Signed && Exact.getSignedMin().isNegative()))
+    return nullptr;
+
+  Type *DoubleTy = Type::getDoubleTy(Cast->getContext());
+  Value *Ops[2];
+  for (unsigned i = 0; i < 2; i++) {
+    Value *V = getTruncated(BO->getOperand(i), i32, BO, Count);
+    Ops[i] = OpUnsigned[i] ? Builder.CreateUIToFP(V, DoubleTy)
+                           : Builder.CreateSIToFP(V, DoubleTy);
+  }
+  Value *D = Builder.CreateBinOp(FOp, Ops[0], Ops[1], BO->getName());
+  Count += 2;
+  if (Cast->getType() != DoubleTy)
+    D = Builder.CreateFPTrunc(D, Cast->getType());
+  return D;
+}
+
+Value *NarrowI64::narrowTrunc(TruncInst *Trunc, unsigned &Count) {
+  BinaryOperator *BO = dyn_cast<BinaryOperator>(Trunc->getOperand(0));
+  if (!BO || !BO->hasOneUse())
+    return nullptr;
+  unsigned Before = Count;
+  Value *V = getTruncated(BO, Trunc->getType(), Trunc, Count);
+  if (Count == Before) {
+    // Nothing could be narrowed, and getTruncated made a copy of Trunc.
+    cast<Instruction>(V)->eraseFromParent();
+    return nullptr;
+  }
+  return V;
+}
+
+bool NarrowI64::runOnFunction(Function &F) {
+  DL = &F.getParent()->getDataLayout();
+  LVI = &getAnalysis<LazyValueInfoWrapperPass>().getLVI();
+  i32 = Type::getInt32Ty(F.getContext());
+  i64 = Type::getInt64Ty(F.getContext());
+
+  SmallVector<WeakVH, 64> Worklist;
+  for (Instruction &I : instructions(F)) {
+    if (isI64(&I) || (isa<ICmpInst>(I) && isI64(I.getOperand(0))) ||
+        ((isa<UIToFPInst>(I) || isa<SIToFPInst>(I) || isa<TruncInst>(I)) &&
+         isI64(I.getOperand(0))))
+      Worklist.push_back(&I);
+  }
+
+  unsigned Count = 0;
+  for (WeakVH &VH : Worklist) {
+    Instruction *I = dyn_cast_or_null<Instruction>(VH);
+    if (!I || I->use_empty())
+      continue;
+    Value *New = nullptr;
+    if (BinaryOperator *BO = dyn_cast<BinaryOperator>(I)) {
+      New = narrowBinary(BO, Count);
+    } else if (ICmpInst *Cmp = dyn_cast<ICmpInst>(I)) {
+      New = narrowICmp(Cmp, Count);
+    } else if (isa<UIToFPInst>(I) || isa<SIToFPInst>(I)) {
+      New = narrowToFP(cast<CastInst>(I), Count);
+    } else if (TruncInst *Trunc = dyn_cast<TruncInst>(I)) {
+      New = narrowTrunc(Trunc, Count);
+    }
+    if (!New)
+      continue;
+    New->takeName(I);
+    I->replaceAllUsesWith(New);
+    RecursivelyDeleteTriviallyDeadInstructions(I);
+  }
+
+  if (Count) {
+    if (NarrowReport)
+      errs() << "narrowed i64 operations in " << F.getName() << ": " << Count
+             << "\n";
+    NumNarrowed += Count;
+  }
+  return Count > 0;
+}
+
+FunctionPass *llvm::createNarrowI64Pass() {
+  return new NarrowI64();
+}
@@ -17,8 +17,14 @@
 // value of these bits (e.g. cmp, select, lshr), the upper bits of the operands
 // are cleared.
 //
+// The work is split in two: a module-level prologue which rewrites function
+// signatures (PromoteIntegerSignatures), and a function-level body which
+// rewrites instructions (PromoteIntegerInstructions). The body only looks at
+// one function at a time, so the pass manager can interleave it with the other
+// function-level legalization passes. PromoteIntegers runs both.
+//
 // Limitations:
-// 1) It can't change function signatures or global variables
+// 1) It can't change global variables
 // 2) Doesn't handle arrays or structs with illegal types
 // 3) Doesn't handle constant expressions (it also doesn't produce them, so it
 //    can run after ExpandConstantExpr)
@@ -85,20 +91,45 @@ public:
   }
 
   bool runOnModule(Module &M) override;
+};
 
-private:
-  typedef DenseMap<const llvm::Function *, DISubprogram *> DebugMap;
-  TypeMap TypeMapper;
+class PromoteIntegerSignatures : public ModulePass {
+public:
+  static char ID;
+
+  PromoteIntegerSignatures() : ModulePass(ID) {
+    initializePromoteIntegerSignaturesPass(*PassRegistry::getPassRegistry());
+  }
 
-  bool ensureCompliantSignature(LLVMContext &Ctx, Function *OldFct, Module &M);
+  bool runOnModule(Module &M) override;
+};
+
+class PromoteIntegerInstructions : public FunctionPass {
+public:
+  static char ID;
+
+  PromoteIntegerInstructions() : FunctionPass(ID) {
+    initializePromoteIntegerInstructionsPass(
+        *PassRegistry::getPassRegistry());
+  }
+
+  bool runOnFunction(Function &F) override;
 };
 } // anonymous namespace
 
 char PromoteIntegers::ID = 0;
+char PromoteIntegerSignatures::ID = 0;
+char PromoteIntegerInstructions::ID = 0;
 
 INITIALIZE_PASS(PromoteIntegers, "nacl-promote-ints",
                 "Promote integer types which are illegal in PNaCl", false,
                 false)
+INITIALIZE_PASS(PromoteIntegerSignatures, "nacl-promote-int-signatures",
+                "Promote illegal integer types in function signatures", false,
+                false)
+INITIALIZE_PASS(PromoteIntegerInstructions, "nacl-promote-int-instructions",
+                "Promote illegal integer types in function bodies", false,
+                false)
 
 static bool isLegalSize(unsigned Size) {
   return Size == 1 || (Size >= 8 && isPowerOf2_32(Size));
@@ -659,8 +690,8 @@ static bool processFunction(Function &F, DataLayout &DL) {
   return Modified;
 }
 
-bool PromoteIntegers::ensureCompliantSignature(
-    LLVMContext &Ctx, Function *OldFct, Module &M) {
+static bool ensureCompliantSignature(TypeMap &TypeMapper, LLVMContext &Ctx,
+                                     Function *OldFct, Module &M) {
 
   auto *NewFctType = cast<FunctionType>(
       TypeMapper.getSimpleType(Ctx, OldFct->getFunctionType()));
@@ -714,19 +745,26 @@ bool PromoteIntegers::ensureCompliantSignature(
   return true;
 }
 
-bool PromoteIntegers::runOnModule(Module &M) {
-  DataLayout DL(&M);
+// Change function signatures. Call sites and the bodies of the rewritten
+// functions are left for processFunction to fix up.
+static bool promoteSignatures(Module &M) {
   LLVMContext &Ctx = M.getContext();
+  TypeMap TypeMapper;
   bool Modified = false;
 
-  // Change function signatures first.
   for (auto I = M.begin(), E = M.end(); I != E;) {
     Function *F = &*I++;
-    bool Changed = ensureCompliantSignature(Ctx, F, M);
+    bool Changed = ensureCompliantSignature(TypeMapper, Ctx, F, M);
     if (Changed)
       F->eraseFromParent();
     Modified |= Changed;
   }
+  return Modified;
+}
+
+bool PromoteIntegers::runOnModule(Module &M) {
+  DataLayout DL(&M);
+  bool Modified = promoteSignatures(M);
 
   for (auto &F : M.getFunctionList())
     Modified |= processFunction(F, DL);
@@ -734,4 +772,21 @@ bool PromoteIntegers::runOnModule(Module &M) {
   return Modified;
 }
 
+bool PromoteIntegerSignatures::runOnModule(Module &M) {
+  return promoteSignatures(M);
+}
+
+bool PromoteIntegerInstructions::runOnFunction(Function &F) {
+  DataLayout DL(F.getParent());
+  return processFunction(F, DL);
+}
+
 ModulePass *llvm::createPromoteIntegersPass() { return new PromoteIntegers(); }
+
+ModulePass *llvm::createPromoteIntegerSignaturesPass() {
+  return new PromoteIntegerSignatures();
+}
+
+FunctionPass *llvm::createPromoteIntegerInstructionsPass() {
+  return new PromoteIntegerInstructions();
+}
@@ -0,0 +1,84 @@
+; RUN: llvm-as < %s -o %t.serial.bc
+; RUN: llvm-as < %s -bitcode-writer-threads=3 -o %t.parallel.bc
+; RUN: cmp %t.serial.bc %t.parallel.bc
+; RUN: llvm-as < %s -bitcode-writer-threads=16 -o %t.many.bc
+; RUN: cmp %t.serial.bc %t.many.bc
+; RUN: llvm-as < %s -preserve-bc-uselistorder=false -o %t.nouselist.bc
+; RUN: llvm-as < %s -preserve-bc-uselistorder=false -bitcode-writer-threads=2 -o %t.nouselist.parallel.bc
+; RUN: cmp %t.nouselist.bc %t.nouselist.parallel.bc
+; RUN: opt -module-summary < %s -o %t.summary.bc
+; RUN: opt -module-summary -bitcode-writer-threads=2 < %s -o %t.summary.parallel.bc
+; RUN: cmp %t.summary.bc %t.summary.parallel.bc
+; RUN: llvm-dis < %t.parallel.bc | FileCheck %s
+
+; Function blocks encoded on several threads must give the same bitcode as
+; writing them one after the other.
+
+; CHECK: define i32 @first(i32 %x)
+; CHECK: define i32 @second(i32 %x)
+; CHECK: define void @third()
+; CHECK: define i32 @fourth(i32* %p)
+
+@g = global i32 0
+
+declare void @llvm.dbg.value(metadata, metadata, metadata)
+
+define i32 @first(i32 %x) !dbg !4 {
+  %a = add i32 %x, 1, !dbg !8
+  call void @llvm.dbg.value(metadata i32 %a, metadata !9, metadata !DIExpression()), !dbg !8
+  %b = mul i32 %a, %x, !dbg !10
+  ret i32 %b, !dbg !10
+  uselistorder i32 %x, { 1, 0 }
+}
+
+define i32 @second(i32 %x) {
+  %v = load i32, i32* @g
+  %s = add i32 %v, %x
+  store i32 %s, i32* @g
+  %c = icmp eq i32 %s, ptrtoint (i32* @g to i32)
+  br i1 %c, label %yes, label %no
+yes:
+  ret i32 %s
+no:
+  %r = call i32 @first(i32 %s)
+  ret i32 %r
+}
+
+define void @third() {
+  store i32 7, i32* @g, !tbaa !11
+  ret void
+}
+
+define i32 @fourth(i32* %p) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [ 0, %entry ], [ %n, %loop ]
+  %q = getelementptr i32, i32* %p, i32 %i
+  store i32 %i, i32* %q
+  %n = add i32 %i, 1
+  %done = icmp eq i32 %n, 10
+  br i1 %done, label %exit, label %loop
+exit:
+  ret i32 %n
+}
+
+uselistorder i32* @g, { 3, 2, 1, 0 }
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!3}
+
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "clang", isOptimized: true, emissionKind: FullDebug, enums: !2)
+!1 = !DIFile(filename: "t.c", directory: "/tmp")
+!2 = !{}
+!3 = !{i32 2, !"Debug Info Version", i32 3}
+!4 = distinct !DISubprogram(name: "first", scope: !1, file: !1, line: 1, type: !5, isLocal: false, isDefinition: true, scopeLine: 1, isOptimized: true, unit: !0, variables: !2)
+!5 = !DISubroutineType(types: !6)
+!6 = !{!7, !7}
+!7 = !DIBasicType(name: "int", size: 32, encoding: DW_ATE_signed)
+!8 = !DILocation(line: 2, column: 3, scope: !4)
+!9 = !DILocalVariable(name: "a", scope: !4, file: !1, line: 2, type: !7)
+!10 = !DILocation(line: 3, column: 3, scope: !4)
+!11 = !{!12, !12, i64 0}
+!12 = !{!"int", !13, i64 0}
+!13 = !{!"tbaa root"}
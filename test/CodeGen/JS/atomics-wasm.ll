@@ -0,0 +1,89 @@
+; RUN: llc -emscripten-enable-pthreads -emscripten-wasm -emscripten-only-wasm < %s | FileCheck %s
+
+; In wasm-only mode, float and 64-bit atomics are emitted inline instead of
+; calling JS helpers, and cmpxchg shifts the pointer by its own width.
+
+target datalayout = "e-p:32:32-i64:64-v128:32:128-n32-S128"
+target triple = "asmjs-unknown-emscripten"
+
+; CHECK-LABEL: function _load_f32(
+; CHECK: i32_bc2f(Atomics_load(HEAP32,$p>>2)|0)
+define float @load_f32(float* %p) {
+  %v = load volatile float, float* %p, align 4
+  ret float %v
+}
+
+; CHECK-LABEL: function _load_f64(
+; CHECK: i64_bc2d(i64_atomics_load($p))
+define double @load_f64(double* %p) {
+  %v = load volatile double, double* %p, align 8
+  ret double %v
+}
+
+; CHECK-LABEL: function _store_f32(
+; CHECK: Atomics_store(HEAP32,$p>>2,i32_bc2i($v))|0
+define void @store_f32(float* %p, float %v) {
+  store volatile float %v, float* %p, align 4
+  ret void
+}
+
+; CHECK-LABEL: function _store_f64(
+; CHECK: i64_atomics_store($p,i64_bc2i($v))|0
+define void @store_f64(double* %p, double %v) {
+  store volatile double %v, double* %p, align 8
+  ret void
+}
+
+; The emscripten_atomic_store_* calls return the stored value, which is only
+; assigned when it is used.
+
+; CHECK-LABEL: function _call_store_f32(
+; CHECK: Atomics_store(HEAP32, $p>>2, i32_bc2i($v))|0;
+; CHECK-NOT: = $v
+; CHECK: }
+define void @call_store_f32(float* %p, float %v) {
+  %r = call float @emscripten_atomic_store_f32(float* %p, float %v)
+  ret void
+}
+
+; CHECK-LABEL: function _call_store_f32_used(
+; CHECK: Atomics_store(HEAP32, $p>>2, i32_bc2i($v))|0; $r = $v;
+define float @call_store_f32_used(float* %p, float %v) {
+  %r = call float @emscripten_atomic_store_f32(float* %p, float %v)
+  ret float %r
+}
+
+; CHECK-LABEL: function _call_store_f64(
+; CHECK: i64_atomics_store($p, i64_bc2i($v))|0;
+; CHECK-NOT: = $v
+; CHECK: }
+define void @call_store_f64(double* %p, double %v) {
+  %r = call double @emscripten_atomic_store_f64(double* %p, double %v)
+  ret void
+}
+
+; CHECK-LABEL: function _call_store_f64_used(
+; CHECK: i64_atomics_store($p, i64_bc2i($v))|0; $r = $v;
+define double @call_store_f64_used(double* %p, double %v) {
+  %r = call double @emscripten_atomic_store_f64(double* %p, double %v)
+  ret double %r
+}
+
+; CHECK-LABEL: function _cas_i16(
+; CHECK: Atomics_compareExchange(HEAP16, $p>>1,
+define i16 @cas_i16(i16* %p, i16 %e, i16 %r) {
+  %pair = cmpxchg i16* %p, i16 %e, i16 %r seq_cst seq_cst
+  %v = extractvalue { i16, i1 } %pair, 0
+  ret i16 %v
+}
+
+; CHECK-LABEL: function _cas_i64(
+; CHECK: i64_atomics_compareExchange($p,$e,$r)
+define i64 @cas_i64(i64* %p, i64 %e, i64 %r) {
+  %pair = cmpxchg i64* %p, i64 %e, i64 %r seq_cst seq_cst
+  %v = extractvalue { i64, i1 } %pair, 0
+  ret i64 %v
+}
+
+declare float @emscripten_atomic_store_f32(float*, float)
+declare double @emscripten_atomic_store_f64(double*, double)
@@ -0,0 +1,39 @@
+; RUN: llc -emscripten-devirtualize < %s | FileCheck %s
+; RUN: llc < %s | FileCheck -check-prefix=NODEVIRT %s
+
+; With -emscripten-devirtualize, an indirect call through a function table
+; that can only hold one function becomes a direct call.
+
+target datalayout = "e-p:32:32-i64:64-v128:32:128-n32-S128"
+target triple = "asmjs-unknown-emscripten"
+
+@handlers = global [3 x i8*] [i8* bitcast (i32 (i32)* @only to i8*), i8* bitcast (void ()* @a to i8*), i8* bitcast (void ()* @b to i8*)]
+
+define i32 @only(i32 %x) {
+  ret i32 %x
+}
+
+define void @a() {
+  ret void
+}
+
+define void @b() {
+  ret void
+}
+
+; CHECK-LABEL: function _call_only(
+; CHECK: _only($x)
+; CHECK-NOT: FUNCTION_TABLE_ii
+; NODEVIRT-LABEL: function _call_only(
+; NODEVIRT: FUNCTION_TABLE_ii[$f & #FM_ii#]($x
+define i32 @call_only(i32 (i32)* %f, i32 %x) {
+  %r = call i32 %f(i32 %x)
+  ret i32 %r
+}
+
+; CHECK-LABEL: function _call_either(
+; CHECK: FUNCTION_TABLE_v[$f & #FM_v#]()
+define void @call_either(void ()* %f) {
+  call void %f()
+  ret void
+}
@@ -1,4 +1,7 @@
-; RUN: llc < %s | FileCheck %s
+; RUN: llc -emscripten-narrow-i64=false < %s | FileCheck %s
+
+; NarrowI64 is disabled, so that the narrow operations below reach ExpandI64
+; rather than being narrowed first (narrow-i64.ll covers that).
 
 target datalayout = "e-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-p:32:32:32-v128:32:128-n32-S128"
 target triple = "asmjs-unknown-emscripten"
@@ -168,6 +171,96 @@ define i32 @icmp_ult(i64 %a, i64 %b) {
   ret i32 %d
 }
 
+; CHECK: function _lshr_const($0,$1) {
+; CHECK-NOT: bitshift64
+; CHECK:  $2 = $1 << 24;
+; CHECK:  $3 = $0 >>> 8;
+; CHECK:  $4 = $3 | $2;
+; CHECK:  $5 = $1 >>> 8;
+; CHECK: }
+define i64 @lshr_const(i64 %a) {
+  %c = lshr i64 %a, 8
+  ret i64 %c
+}
+
+; CHECK: function _ashr_const($0,$1) {
+; CHECK-NOT: bitshift64
+; CHECK:  $2 = $1 >> 8;
+; CHECK:  $3 = $1 >> 31;
+; CHECK: }
+define i64 @ashr_const(i64 %a) {
+  %c = ashr i64 %a, 40
+  ret i64 %c
+}
+
+; CHECK: function _shl_const($0,$1) {
+; CHECK-NOT: bitshift64
+; CHECK:  $2 = $0 << 8;
+; CHECK:  setTempRet0(($2) | 0);
+; CHECK:  return 0;
+; CHECK: }
+define i64 @shl_const(i64 %a) {
+  %c = shl i64 %a, 40
+  ret i64 %c
+}
+
+; CHECK: function _add_narrow($a,$b) {
+; CHECK-NOT: i64Add
+; CHECK:  $0 = (($a) + ($b))|0;
+; CHECK:  $1 = ($0>>>0)<($a>>>0);
+; CHECK: }
+define i64 @add_narrow(i32 %a, i32 %b) {
+  %x = zext i32 %a to i64
+  %y = zext i32 %b to i64
+  %c = add i64 %x, %y
+  ret i64 %c
+}
+
+; CHECK: function _udiv_narrow($a,$b) {
+; CHECK-NOT: udivdi3
+; CHECK:  $0 = (($a>>>0) / ($b>>>0))&-1;
+; CHECK: }
+define i64 @udiv_narrow(i32 %a, i32 %b) {
+  %x = zext i32 %a to i64
+  %y = zext i32 %b to i64
+  %c = udiv i64 %x, %y
+  ret i64 %c
+}
+
+; CHECK: function _icmp_slt_narrow($a,$b) {
+; CHECK:  $0 = ($a>>>0)<($b>>>0);
+; CHECK-NOT: ==
+; CHECK: }
+define i32 @icmp_slt_narrow(i32 %a, i32 %b) {
+  %x = zext i32 %a to i64
+  %y = zext i32 %b to i64
+  %c = icmp slt i64 %x, %y
+  %d = zext i1 %c to i32
+  ret i32 %d
+}
+
+; The high word of the product is never used, so no library call is needed.
+; CHECK: function _mul_low($0,$1,$2,$3) {
+; CHECK-NOT: muldi3
+; CHECK-NOT: getTempRet0
+; CHECK:  $4 = Math_imul($0, $2)|0;
+; CHECK: }
+define i32 @mul_low(i64 %a, i64 %b) {
+  %c = mul i64 %a, %b
+  %d = trunc i64 %c to i32
+  ret i32 %d
+}
+
+; CHECK: function _call_low($0,$1) {
+; CHECK:  $2 = (_foo(($0|0),($1|0))|0);
+; CHECK-NOT: getTempRet0
+; CHECK: }
+define i32 @call_low(i64 %arg) {
+  %ret = call i64 @foo(i64 %arg)
+  %low = trunc i64 %ret to i32
+  ret i32 %low
+}
+
 ; CHECK: function _load($a) {
 ; CHECK:  $0 = $a;
 ; CHECK:  $1 = $0;
@@ -0,0 +1,47 @@
+; RUN: llc < %s | FileCheck %s
+
+; Test the data image of globals that FlattenGlobals keeps as they are, that
+; point at globals flattened after them, or that share a ConstantExpr.
+
+target datalayout = "e-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-p:32:32:32-v128:32:128-n32-S128"
+target triple = "asmjs-unknown-emscripten"
+
+; The i8 array is already in normal form and is kept, at its own alignment.
+@normal_form = global [4 x i8] c"abcd", align 4
+
+; This refers to a global which is only flattened later on.
+@reloc_to_later = global i32* @flattened_later
+@flattened_later = global i32 261
+
+; Both initializers use the same ConstantExpr, which must survive the first
+; one being destroyed.
+@shared_target = global [4 x i32] zeroinitializer
+@shared_expr1 = global { i32*, i32 } { i32* getelementptr ([4 x i32], [4 x i32]* @shared_target, i32 0, i32 2), i32 1 }
+@shared_expr2 = global { i32*, i32 } { i32* getelementptr ([4 x i32], [4 x i32]* @shared_target, i32 0, i32 2), i32 2 }
+
+; CHECK: function _loads() {
+; CHECK:  $b = HEAP8[25>>0]|0;
+; CHECK:  $q = HEAP32[7]|0;
+; CHECK:  $t = HEAP32[2]|0;
+; CHECK:  $y = HEAP32[20>>2]|0;
+define i32 @loads() {
+  %p = getelementptr [4 x i8], [4 x i8]* @normal_form, i32 0, i32 1
+  %b = load i8, i8* %p
+  %c = zext i8 %b to i32
+  %q = load i32*, i32** @reloc_to_later
+  %v = load i32, i32* %q
+  %s = add i32 %c, %v
+  %r = getelementptr { i32*, i32 }, { i32*, i32 }* @shared_expr1, i32 0, i32 0
+  %t = load i32*, i32** %r
+  %w = load i32, i32* %t
+  %x = add i32 %s, %w
+  %r2 = getelementptr { i32*, i32 }, { i32*, i32 }* @shared_expr2, i32 0, i32 1
+  %y = load i32, i32* %r2
+  %z = add i32 %x, %y
+  ret i32 %z
+}
+
+; shared_expr1 and shared_expr2 both point 8 bytes into shared_target, at 40;
+; normal_form holds "abcd" at 24; reloc_to_later points at flattened_later, at
+; 32, which holds 261.
+; CHECK: allocate([48,0,0,0,1,0,0,0,48,0,0,0,2,0,0,0,97,98,99,100,32,0,0,0,5,1,0,0], "i8", ALLOC_NONE, Runtime.GLOBAL_BASE);
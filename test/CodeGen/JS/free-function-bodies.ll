@@ -0,0 +1,28 @@
+; RUN: llc < %s | FileCheck %s
+; RUN: llc -emscripten-free-function-bodies < %s | FileCheck %s
+
+; Function bodies are freed once they are emitted. Declarations used only in
+; them must still be reported, and calls to functions that were already
+; emitted must still be calls to definitions.
+
+; CHECK: function _foo($x) {
+; CHECK: _ext(($x|0))
+; CHECK: function _bar() {
+; CHECK: _foo(1)
+; CHECK: "declares": ["ext"],
+; CHECK: "implementedFunctions": ["_foo", "_bar"],
+
+target datalayout = "e-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-p:32:32:32-v128:32:128-n32-S128"
+target triple = "asmjs-unknown-emscripten"
+
+declare i32 @ext(i32)
+
+define i32 @foo(i32 %x) {
+  %r = call i32 @ext(i32 %x)
+  ret i32 %r
+}
+
+define i32 @bar() {
+  %r = call i32 @foo(i32 1)
+  ret i32 %r
+}
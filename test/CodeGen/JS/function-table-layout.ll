@@ -0,0 +1,28 @@
+; RUN: llc < %s | FileCheck %s
+; RUN: llc -emscripten-no-aliasing-function-pointers < %s | FileCheck -check-prefix=NOALIAS %s
+
+; Function table indices are assigned up front, with the most referenced
+; functions first in each table, and without aliasing, smaller tables first.
+
+target datalayout = "e-p:32:32-i64:64-v128:32:128-n32-S128"
+target triple = "asmjs-unknown-emscripten"
+
+; CHECK: "ii": "var FUNCTION_TABLE_ii = [0,_i1];"
+; CHECK: "v": "var FUNCTION_TABLE_v = [0,_v2,_v1,0];"
+
+; NOALIAS: "ii": "var FUNCTION_TABLE_ii = [0,_i1];"
+; NOALIAS: "v": "var FUNCTION_TABLE_v = [0,0,_v2,_v1];"
+
+@table = global [4 x i8*] [i8* bitcast (i32 (i32)* @i1 to i8*), i8* bitcast (void ()* @v1 to i8*), i8* bitcast (void ()* @v2 to i8*), i8* bitcast (void ()* @v2 to i8*)]
+
+define void @v1() {
+  ret void
+}
+
+define void @v2() {
+  ret void
+}
+
+define i32 @i1(i32 %x) {
+  ret i32 %x
+}
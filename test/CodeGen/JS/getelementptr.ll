@@ -45,3 +45,45 @@ define i16 @no_reassociate(%struct.A* %p, i32 %i) {
   ret i16 %t0
 }
 
+
+; A constant-offset getelementptr that is only used by a load or store in
+; its own block is folded into the heap access.
+
+; CHECK: function _fold_offset($p) {
+; CHECK-NOT: $arrayidx =
+; CHECK: $t0 = HEAP16[((($p)) + 10|0)>>1]|0;
+define i16 @fold_offset(%struct.A* %p) {
+  %arrayidx = getelementptr %struct.A, %struct.A* %p, i32 0, i32 1, i32 3
+  %t0 = load i16, i16* %arrayidx, align 2
+  ret i16 %t0
+}
+
+; ... but not when several accesses use it, which would repeat the addition.
+
+; CHECK: function _no_fold_two_uses($p) {
+; CHECK: $arrayidx = ((($p)) + 10|0);
+; CHECK: $t0 = HEAP16[$arrayidx>>1]|0;
+; CHECK: HEAP16[$arrayidx>>1] = $t1;
+define void @no_fold_two_uses(%struct.A* %p) {
+  %arrayidx = getelementptr %struct.A, %struct.A* %p, i32 0, i32 1, i32 3
+  %t0 = load i16, i16* %arrayidx, align 2
+  %t1 = add i16 %t0, 1
+  store i16 %t1, i16* %arrayidx, align 2
+  ret void
+}
+
+; ... but not when it is used in another block.
+
+; CHECK: function _no_fold_other_block($p,$c) {
+; CHECK: $arrayidx = ((($p)) + 10|0);
+; CHECK: $t0 = HEAP16[$arrayidx>>1]|0;
+define i16 @no_fold_other_block(%struct.A* %p, i1 %c) {
+entry:
+  %arrayidx = getelementptr %struct.A, %struct.A* %p, i32 0, i32 1, i32 3
+  br i1 %c, label %load, label %done
+load:
+  %t0 = load i16, i16* %arrayidx, align 2
+  ret i16 %t0
+done:
+  ret i16 0
+}
@@ -0,0 +1,37 @@
+; RUN: llc < %s | FileCheck %s
+
+; Accesses that are marked unaligned but whose pointers are provably aligned
+; are emitted as single heap accesses.
+
+target datalayout = "e-p:32:32-i64:64-v128:32:128-n32-S128"
+target triple = "asmjs-unknown-emscripten"
+
+@g = global [4 x i32] zeroinitializer, align 16
+
+; CHECK: function _global_offset() {
+; CHECK: HEAP32[{{[0-9]+}}>>2]|0;
+define i32 @global_offset() {
+  %p = getelementptr [4 x i32], [4 x i32]* @g, i32 0, i32 2
+  %v = load i32, i32* %p, align 1
+  ret i32 %v
+}
+
+; CHECK: function _assumed($p,$v) {
+; CHECK: HEAPF64[$p>>3] = $v;
+define void @assumed(double* %p, double %v) {
+  %i = ptrtoint double* %p to i32
+  %m = and i32 %i, 7
+  %c = icmp eq i32 %m, 0
+  call void @llvm.assume(i1 %c)
+  store double %v, double* %p, align 1
+  ret void
+}
+
+; CHECK: function _unknown($p) {
+; CHECK: HEAPU8[$p>>0]|(HEAPU8[$p+1>>0]<<8)
+define i32 @unknown(i32* %p) {
+  %v = load i32, i32* %p, align 1
+  ret i32 %v
+}
+
+declare void @llvm.assume(i1)
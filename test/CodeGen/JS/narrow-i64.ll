@@ -0,0 +1,81 @@
+; RUN: llc < %s | FileCheck %s
+; RUN: llc < %s -emscripten-narrow-i64-report 2>&1 >/dev/null | FileCheck %s --check-prefix=REPORT
+
+; Test that i64 operations whose values fit in 32 bits are narrowed before
+; they reach ExpandI64.
+
+; REPORT: narrowed i64 operations in udiv_zext: 1
+; REPORT-NEXT: narrowed i64 operations in mul_masked: 3
+; REPORT-NEXT: narrowed i64 operations in trunc_add: 1
+; REPORT-NEXT: narrowed i64 operations in sum_to_double: 2
+; REPORT-NEXT: narrowed i64 operations in cmp_sext: 1
+
+target datalayout = "e-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-p:32:32:32-v128:32:128-n32-S128"
+target triple = "asmjs-unknown-emscripten"
+
+; CHECK: function _udiv_zext($a,$b) {
+; CHECK-NOT: ___udivdi3
+; CHECK: }
+define i64 @udiv_zext(i32 %a, i32 %b) {
+  %x = zext i32 %a to i64
+  %y = zext i32 %b to i64
+  %c = udiv i64 %x, %y
+  ret i64 %c
+}
+
+; CHECK: function _mul_masked($0,$1,$2,$3) {
+; CHECK-NOT: ___muldi3
+; CHECK: Math_imul(
+; CHECK: }
+define i64 @mul_masked(i64 %a, i64 %b) {
+  %x = and i64 %a, 65535
+  %y = and i64 %b, 65535
+  %c = mul i64 %x, %y
+  ret i64 %c
+}
+
+; CHECK: function _trunc_add($0,$1,$2,$3) {
+; CHECK-NOT: _i64Add
+; CHECK: }
+define i32 @trunc_add(i64 %a, i64 %b) {
+  %c = add i64 %a, %b
+  %d = trunc i64 %c to i32
+  ret i32 %d
+}
+
+; CHECK: function _sum_to_double($a,$b) {
+; CHECK-NOT: _i64Add
+; CHECK-NOT: UItoD
+; CHECK: (+($a>>>0))
+; CHECK: }
+define double @sum_to_double(i32 %a, i32 %b) {
+  %x = zext i32 %a to i64
+  %y = zext i32 %b to i64
+  %c = add i64 %x, %y
+  %d = uitofp i64 %c to double
+  ret double %d
+}
+
+; The exact product does not fit in 53 bits, although the wrapped i64 one
+; does, so it must not be computed in double.
+; CHECK: function _mul_wraps_to_double($a) {
+; CHECK: ___muldi3(
+; CHECK: }
+define double @mul_wraps_to_double(i32 %a) {
+  %a2 = or i32 %a, -65536
+  %x = zext i32 %a2 to i64
+  %m = mul i64 %x, 4294967295
+  %d = sitofp i64 %m to double
+  ret double %d
+}
+
+; CHECK: function _cmp_sext($a,$b) {
+; CHECK: ($a|0)<($b|0)
+; CHECK: }
+define i32 @cmp_sext(i32 %a, i32 %b) {
+  %x = sext i32 %a to i64
+  %y = sext i32 %b to i64
+  %c = icmp slt i64 %x, %y
+  %d = zext i1 %c to i32
+  ret i32 %d
+}
@@ -0,0 +1,69 @@
+; RUN: llc -globalize-constant-vectors-locals < %s | FileCheck %s
+; RUN: llc -globalize-constant-vectors-locals -globalize-constant-vectors-max-local-size=0 < %s | FileCheck --check-prefix=GLOBAL %s
+; RUN: llc < %s | FileCheck --check-prefix=DEFAULT %s
+
+; With -globalize-constant-vectors-locals, constant vectors are built once at
+; function entry instead of in the loop. Non-splat vectors larger than
+; -globalize-constant-vectors-max-local-size are loaded from a global instead.
+
+target datalayout = "e-i1:8:8-i8:8:8-i16:16:16-i32:32:32-i64:64:64-f32:32:32-f64:64:64-p:32:32:32-v128:32:128-n32-S128"
+target triple = "asmjs-unknown-emscripten"
+
+; CHECK: function _scale($p,$n) {
+; CHECK: $constant_vector[[S:[0-9]+]] = SIMD_Float32x4_splat(Math_fround(+2));
+; CHECK: $constant_vector[[C:[0-9]+]] = SIMD_Float32x4(Math_fround(+1), Math_fround(+2), Math_fround(+3), Math_fround(+4));
+; CHECK: while(1) {
+; CHECK: $m = SIMD_Float32x4_mul($v,$constant_vector[[S]]);
+; CHECK-NEXT: $a = SIMD_Float32x4_add($m,$constant_vector[[C]]);
+; CHECK: }
+
+; GLOBAL: function _scale($p,$n) {
+; GLOBAL: $constant_vector[[S:[0-9]+]] = SIMD_Float32x4_splat(Math_fround(+2));
+; GLOBAL-NEXT: $constant_vector[[C:[0-9]+]] = SIMD_Float32x4_load(HEAPU8, {{[0-9]+}});
+; GLOBAL: while(1) {
+; GLOBAL: $m = SIMD_Float32x4_mul($v,$constant_vector[[S]]);
+; GLOBAL-NEXT: $a = SIMD_Float32x4_add($m,$constant_vector[[C]]);
+; GLOBAL: }
+
+; DEFAULT: function _scale($p,$n) {
+; DEFAULT-NOT: constant_vector
+; DEFAULT: $m = SIMD_Float32x4_mul($v,SIMD_Float32x4_splat(Math_fround(+2)));
+; DEFAULT-NEXT: $a = SIMD_Float32x4_add($m,SIMD_Float32x4(Math_fround(+1),Math_fround(+2),Math_fround(+3),Math_fround(+4)));
+define void @scale(<4 x float>* %p, i32 %n) {
+entry:
+  br label %loop
+
+loop:
+  %i = phi i32 [ 0, %entry ], [ %next, %loop ]
+  %q = getelementptr <4 x float>, <4 x float>* %p, i32 %i
+  %v = load <4 x float>, <4 x float>* %q
+  %m = fmul <4 x float> %v, <float 2.0, float 2.0, float 2.0, float 2.0>
+  %a = fadd <4 x float> %m, <float 1.0, float 2.0, float 3.0, float 4.0>
+  store <4 x float> %a, <4 x float>* %q
+  %next = add i32 %i, 1
+  %done = icmp eq i32 %next, %n
+  br i1 %done, label %exit, label %loop
+
+exit:
+  ret void
+}
+
+; Vectors narrower than 128 bits are padded with zero lanes.
+; CHECK: function _half($p) {
+; CHECK: $constant_vector{{[0-9]+}} = SIMD_Float32x4(Math_fround(+3.5), Math_fround(+7.5), Math_fround(+0), Math_fround(+0));
+define void @half(i8* %p) {
+  %q = bitcast i8* %p to <2 x float>*
+  %t = load <2 x float>, <2 x float>* %q
+  %s = fadd <2 x float> %t, <float 3.5, float 7.5>
+  store <2 x float> %s, <2 x float>* %q
+  ret void
+}
+
+; Shift amounts stay immediate.
+; CHECK: function _shift($a) {
+; CHECK-NOT: constant_vector
+; CHECK: $s = SIMD_Int32x4_shiftLeftByScalar($a,3);
+define <4 x i32> @shift(<4 x i32> %a) {
+  %s = shl <4 x i32> %a, <i32 3, i32 3, i32 3, i32 3>
+  ret <4 x i32> %s
+}
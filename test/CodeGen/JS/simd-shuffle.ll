@@ -522,3 +522,33 @@ entry:
   %sel = shufflevector <4 x float> %a, <4 x float> %b, <3 x i32><i32 7, i32 0, i32 5>
   ret <3 x float> %sel
 }
+
+; CHECK: function _identity_int32x4($a,$b) {
+; CHECK:  $sel = $b;
+; CHECK:  return (SIMD_Int32x4_check($sel));
+; CHECK: }
+define <4 x i32> @identity_int32x4(<4 x i32> %a, <4 x i32> %b) nounwind {
+entry:
+  %sel = shufflevector <4 x i32> %a, <4 x i32> %b, <4 x i32><i32 4, i32 undef, i32 6, i32 7>
+  ret <4 x i32> %sel
+}
+
+; CHECK: function _sameop_float32x4($a,$b) {
+; CHECK:  $sel = SIMD_Float32x4_swizzle($a, 1, 0, 3, 2);
+; CHECK:  return (SIMD_Float32x4_check($sel));
+; CHECK: }
+define <4 x float> @sameop_float32x4(<4 x float> %a, <4 x float> %b) nounwind {
+entry:
+  %sel = shufflevector <4 x float> %a, <4 x float> %a, <4 x i32><i32 5, i32 0, i32 7, i32 2>
+  ret <4 x float> %sel
+}
+
+; CHECK: function _undefop_int32x4($a,$b) {
+; CHECK:  $sel = SIMD_Int32x4_swizzle($b, 3, 0, 1, 0);
+; CHECK:  return (SIMD_Int32x4_check($sel));
+; CHECK: }
+define <4 x i32> @undefop_int32x4(<4 x i32> %a, <4 x i32> %b) nounwind {
+entry:
+  %sel = shufflevector <4 x i32> undef, <4 x i32> %b, <4 x i32><i32 7, i32 0, i32 5, i32 undef>
+  ret <4 x i32> %sel
+}
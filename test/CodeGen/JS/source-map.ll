@@ -0,0 +1,33 @@
+; RUN: llc -emscripten-source-map=%t.map < %s | FileCheck %s
+; RUN: FileCheck -check-prefix=MAP %s < %t.map
+
+; llc should write a source map for statements with debug locations, and map
+; each function to its subprogram.
+
+target datalayout = "e-p:32:32-i64:64-v128:32:128-n32-S128"
+target triple = "asmjs-unknown-emscripten"
+
+; CHECK: function _add($a,$b) {
+; CHECK: //@line 3 "src.c"
+; CHECK: }
+
+; The function starts at src.c:1:1 under the name "add", and its two
+; statements map to src.c:3:12 and src.c:3:3.
+; MAP: {"version":3,"sources":["src.c"],"names":["add"],"mappings":";;AAAAA;;;;;CAEW;CAAT"}
+define i32 @add(i32 %a, i32 %b) !dbg !5 {
+  %sum = add i32 %b, %a, !dbg !7
+  ret i32 %sum, !dbg !8
+}
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!3, !4}
+
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "clang", isOptimized: true, runtimeVersion: 0, emissionKind: FullDebug, enums: !2)
+!1 = !DIFile(filename: "src.c", directory: "/tmp")
+!2 = !{}
+!3 = !{i32 2, !"Dwarf Version", i32 4}
+!4 = !{i32 2, !"Debug Info Version", i32 3}
+!5 = distinct !DISubprogram(name: "add", scope: !1, file: !1, line: 1, type: !6, isLocal: false, isDefinition: true, scopeLine: 1, isOptimized: true, unit: !0, variables: !2)
+!6 = !DISubroutineType(types: !2)
+!7 = !DILocation(line: 3, column: 12, scope: !5)
+!8 = !DILocation(line: 3, column: 3, scope: !5)
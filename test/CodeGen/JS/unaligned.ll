@@ -0,0 +1,47 @@
+; RUN: llc < %s | FileCheck %s
+; RUN: llc < %s -emscripten-unaligned-report 2>&1 >/dev/null | FileCheck %s --check-prefix=REPORT
+
+; Unaligned accesses are assembled from aligned ones in registers; floats
+; only go through tempDoublePtr once to reinterpret their bits.
+
+target datalayout = "e-p:32:32-i64:64-v128:32:128-n32-S128"
+target triple = "asmjs-unknown-emscripten"
+
+; CHECK: function _load_double_1($p) {
+; CHECK: HEAP32[tempDoublePtr>>2]=HEAPU8[$p>>0]|(HEAPU8[$p+1>>0]<<8)|(HEAPU8[$p+2>>0]<<16)|(HEAPU8[$p+3>>0]<<24);HEAP32[tempDoublePtr+4>>2]=HEAPU8[$p+4>>0]|(HEAPU8[$p+5>>0]<<8)|(HEAPU8[$p+6>>0]<<16)|(HEAPU8[$p+7>>0]<<24);$v = +HEAPF64[tempDoublePtr>>3];
+define double @load_double_1(double* %p) {
+  %v = load double, double* %p, align 1
+  ret double %v
+}
+
+; CHECK: function _load_float_2($p) {
+; CHECK: HEAP32[tempDoublePtr>>2]=HEAPU16[$p>>1]|(HEAPU16[$p+2>>1]<<16);$v = +HEAPF32[tempDoublePtr>>2];
+define float @load_float_2(float* %p) {
+  %v = load float, float* %p, align 2
+  ret float %v
+}
+
+; CHECK: function _store_double_2($p,$v) {
+; CHECK: HEAPF64[tempDoublePtr>>3]=$v;unaligned=HEAP32[tempDoublePtr>>2]|0;HEAP16[$p>>1]=unaligned&65535;HEAP16[$p+2>>1]=unaligned>>>16;unaligned=HEAP32[tempDoublePtr+4>>2]|0;HEAP16[$p+4>>1]=unaligned&65535;HEAP16[$p+6>>1]=unaligned>>>16;
+define void @store_double_2(double* %p, double %v) {
+  store double %v, double* %p, align 2
+  ret void
+}
+
+; CHECK: function _store_float_1($p,$v) {
+; CHECK: HEAPF32[tempDoublePtr>>2]=$v;unaligned=HEAP32[tempDoublePtr>>2]|0;HEAP8[$p>>0]=unaligned&255;HEAP8[$p+1>>0]=(unaligned>>8)&255;HEAP8[$p+2>>0]=(unaligned>>16)&255;HEAP8[$p+3>>0]=unaligned>>24;
+define void @store_float_1(float* %p, float %v) {
+  store float %v, float* %p, align 1
+  ret void
+}
+
+; REPORT: unaligned accesses in copy_words: 2
+; REPORT-NEXT: load of 4 bytes with alignment 1
+; REPORT-NEXT: store of 4 bytes with alignment 2
+; REPORT: unaligned accesses in load_double_1: 1
+; REPORT-NEXT: load of 8 bytes with alignment 1
+define void @copy_words(i32* %p, i32* %q) {
+  %v = load i32, i32* %p, align 1
+  store i32 %v, i32* %q, align 2
+  ret void
+}
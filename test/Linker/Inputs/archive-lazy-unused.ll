@@ -0,0 +1 @@
+define void @unused() { ret void }
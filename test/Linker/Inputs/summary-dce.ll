@@ -0,0 +1,11 @@
+define void @used() {
+  ret void
+}
+
+define void @dead_there() {
+  ret void
+}
+
+define void @unused() {
+  ret void
+}
@@ -0,0 +1,31 @@
+; RUN: llvm-as %S/Inputs/basiclink.a.ll -o %t.a.bc
+; RUN: llvm-as %S/Inputs/basiclink.b.ll -o %t.b.bc
+; RUN: llvm-as %S/Inputs/archive-lazy-unused.ll -o %t.unused.bc
+; RUN: rm -f %t.lib.a
+; RUN: llvm-ar rcs %t.lib.a %t.a.bc %t.b.bc %t.unused.bc
+; RUN: llvm-nm -print-armap %t.lib.a | FileCheck --check-prefix=ARMAP %s
+; RUN: llvm-link -archive-lazy %s %t.lib.a -S | FileCheck --implicit-check-not=@unused %s
+; RUN: llvm-link -archive-lazy -threads=2 %s %t.lib.a -S | FileCheck --implicit-check-not=@unused %s
+; RUN: not llvm-link -archive-lazy -tree-link %s %t.lib.a -S 2>&1 | FileCheck --check-prefix=TREE %s
+
+; The symbol table is read from the bitcode without loading it.
+; ARMAP: Archive map
+; ARMAP-NEXT: foo in {{.*}}.a.bc
+; ARMAP-NEXT: bar in {{.*}}.b.bc
+; ARMAP-NEXT: baz in {{.*}}.b.bc
+; ARMAP-NEXT: unused in {{.*}}.unused.bc
+
+; @bar pulls in b.bc, which in turn needs @foo from a.bc, listed before it.
+; CHECK-DAG: @baz = global i32 0
+; CHECK-DAG: define i32* @foo(i32 %x)
+; CHECK-DAG: define i32* @bar()
+; CHECK-DAG: define i32* @main()
+
+; TREE: -archive-lazy cannot be used with -tree-link
+
+define i32* @main() {
+  %ret = call i32* @bar()
+  ret i32* %ret
+}
+
+declare i32* @bar()
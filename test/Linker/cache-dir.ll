@@ -0,0 +1,23 @@
+; RUN: rm -rf %t.cache
+; RUN: llvm-link -tree-link -cache-dir=%t.cache %S/Inputs/basiclink.a.ll %S/Inputs/basiclink.b.ll %s -S | FileCheck %s
+; RUN: ls %t.cache | count 2
+; RUN: llvm-link -v -tree-link -cache-dir=%t.cache %S/Inputs/basiclink.a.ll %S/Inputs/basiclink.b.ll %s -o %t.bc 2>&1 | FileCheck --check-prefix=REUSE %s
+; RUN: llvm-dis < %t.bc | FileCheck %s
+; RUN: not llvm-link -cache-dir=%t.cache %s -S 2>&1 | FileCheck --check-prefix=NOTREE %s
+
+; CHECK-DAG: @baz = global i32 0
+; CHECK-DAG: define i32* @foo(i32 %x)
+; CHECK-DAG: define i32* @bar()
+; CHECK-DAG: define i32* @main()
+
+; REUSE: Reusing the cached link of
+; REUSE: Reusing the cached link of
+
+; NOTREE: -cache-dir can only be used with -tree-link
+
+define i32* @main() {
+  %ret = call i32* @bar()
+  ret i32* %ret
+}
+
+declare i32* @bar()
@@ -0,0 +1,38 @@
+; RUN: opt -module-summary %s -o %t.bc
+; RUN: opt -module-summary %S/Inputs/summary-dce.ll -o %t2.bc
+; RUN: llvm-link -summary-dce %t.bc %t2.bc -S | FileCheck --implicit-check-not=dead_ --implicit-check-not=unused %s
+; RUN: llvm-link -summary-dce -summary-dce-root=main,unused %t.bc %t2.bc -S | FileCheck --implicit-check-not=dead_ --check-prefix=ROOTS %s
+; RUN: llvm-link -summary-dce %t.bc %S/Inputs/summary-dce.ll -S | FileCheck --implicit-check-not=dead_here --check-prefix=NOSUMMARY %s
+
+; CHECK-DAG: define i32 @main()
+; CHECK-DAG: define internal void @init()
+; CHECK-DAG: define void @used()
+
+; ROOTS-DAG: define i32 @main()
+; ROOTS-DAG: define void @used()
+; ROOTS-DAG: define void @unused()
+
+; An input without a summary keeps all it defines and all it uses.
+; NOSUMMARY-DAG: define i32 @main()
+; NOSUMMARY-DAG: define void @used()
+; NOSUMMARY-DAG: define void @dead_there()
+; NOSUMMARY-DAG: define void @unused()
+
+@llvm.global_ctors = appending global [1 x { i32, void ()*, i8* }] [{ i32, void ()*, i8* } { i32 65535, void ()* @init, i8* null }]
+
+define internal void @init() {
+  ret void
+}
+
+define i32 @main() {
+  call void @used()
+  ret i32 0
+}
+
+define void @dead_here() {
+  call void @dead_there()
+  ret void
+}
+
+declare void @used()
+declare void @dead_there()
@@ -0,0 +1,22 @@
+; Inputs read ahead on a thread pool are still linked in command-line order.
+; RUN: llvm-as %S/Inputs/basiclink.a.ll -o %t.a.bc
+; RUN: llvm-link -threads=2 %t.a.bc %S/Inputs/basiclink.b.ll %s -S | FileCheck %s
+; RUN: llvm-link %t.a.bc %S/Inputs/basiclink.b.ll %s -S > %t.serial.ll
+; RUN: llvm-link -threads=2 %t.a.bc %S/Inputs/basiclink.b.ll %s -S > %t.threads.ll
+; RUN: diff %t.serial.ll %t.threads.ll
+; RUN: not llvm-link -threads=2 %s %t.missing.bc -o %t.bc 2>&1 | FileCheck --check-prefix=MISSING %s
+
+; CHECK: @baz = global i32 0
+; CHECK: define i32* @foo(i32 %x)
+; CHECK: define i32* @bar()
+; CHECK: define i32* @main()
+
+; MISSING: Could not open input file
+; MISSING: error loading file '{{.*}}.missing.bc'
+
+define i32* @main() {
+  %ret = call i32* @bar()
+  ret i32* %ret
+}
+
+declare i32* @bar()
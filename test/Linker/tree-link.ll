@@ -0,0 +1,20 @@
+; RUN: llvm-as %S/Inputs/basiclink.a.ll -o %t.a.bc
+; RUN: llvm-link -tree-link -threads=2 %t.a.bc %S/Inputs/basiclink.b.ll %s -S | FileCheck %s
+; RUN: llvm-link -tree-link %s -S | FileCheck --check-prefix=SINGLE %s
+; RUN: not llvm-link -tree-link -only-needed %s -S 2>&1 | FileCheck --check-prefix=ONLYNEEDED %s
+
+; CHECK-DAG: @baz = global i32 0
+; CHECK-DAG: define i32* @foo(i32 %x)
+; CHECK-DAG: define i32* @bar()
+; CHECK-DAG: define i32* @main()
+
+; SINGLE: define i32* @main()
+
+; ONLYNEEDED: -tree-link cannot be used with -only-needed
+
+define i32* @main() {
+  %ret = call i32* @bar()
+  ret i32* %ret
+}
+
+declare i32* @bar()
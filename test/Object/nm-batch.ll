@@ -0,0 +1,56 @@
+; RUN: llvm-as %s -o %t.bc
+; RUN: rm -f %t.a
+; RUN: llvm-ar rcs %t.a %t.bc
+; RUN: echo %t.bc > %t.list
+; RUN: echo %t.missing.bc >> %t.list
+; RUN: echo %t.a >> %t.list
+; RUN: not llvm-nm -batch < %t.list 2> %t.err | FileCheck %s
+; RUN: FileCheck --check-prefix=ERR %s < %t.err
+; RUN: echo %t.bc | llvm-nm -batch -undefined-only | FileCheck --check-prefix=UNDEF %s
+; RUN: llvm-nm %t.bc | FileCheck --check-prefix=NM %s
+
+; CHECK: {{.*}}.bc:
+; CHECK-NEXT: T f
+; CHECK-NEXT: U g
+; CHECK-NEXT: D data
+; CHECK-NEXT: W weak_data
+; CHECK-NEXT: C common
+; CHECK-NEXT: d local
+; CHECK-NEXT: w weak_decl
+; CHECK-NOT: {{.}}
+; CHECK: {{.*}}.a({{.*}}.bc):
+; CHECK-NEXT: T f
+; CHECK-NEXT: U g
+
+; ERR: {{.*}}.missing.bc: {{.*}}
+
+; UNDEF: {{.*}}.bc:
+; UNDEF-NEXT: U g
+; UNDEF-NEXT: w weak_decl
+; UNDEF-NOT: {{.}}
+
+; The type characters match those printed without -batch.
+; NM-DAG: T f
+; NM-DAG: U g
+; NM-DAG: D data
+; NM-DAG: W weak_data
+; NM-DAG: w weak_decl
+; NM-DAG: C common
+; NM-DAG: d local
+
+target datalayout = "e-p:32:32-i64:64-v128:32:128-n32-S128"
+target triple = "asmjs-unknown-emscripten"
+
+@data = global i32 1
+@weak_data = weak global i32 2
+@common = common global i32 0
+@local = internal global i32 3
+@weak_decl = extern_weak global i32
+
+define void @f() {
+  %v = load i32, i32* @local
+  call void @g(i32 %v)
+  ret void
+}
+
+declare void @g(i32)
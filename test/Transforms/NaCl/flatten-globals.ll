@@ -188,6 +188,38 @@ target datalayout = "p:32:32:32"
 ; CHECK: @block_addend = global i32 add (i32 ptrtoint (i8* blockaddress(@func_with_block, %label) to i32), i32 100)
 
 
+; Globals which are already in normal form are kept as they are, rather than
+; copied into a new global, which would drop their metadata.
+
+@normal_form = global [4 x i8] c"abcd", !type !0
+; CHECK: @normal_form = global [4 x i8] c"abcd", align 1, !type !0
+
+@normal_form_zero = global [4 x i8] zeroinitializer, !type !0
+; CHECK: @normal_form_zero = global [4 x i8] zeroinitializer, align 1, !type !0
+
+@normal_form_extern = external global [4 x i8], !type !0
+; CHECK: @normal_form_extern = external global [4 x i8], align 1, !type !0
+
+
+; A reference to a global which is only flattened later on
+
+@reloc_to_later = global i32* @flattened_later
+; CHECK: @reloc_to_later = global i32 ptrtoint ([4 x i8]* @flattened_later to i32)
+
+@flattened_later = global i32 261
+; CHECK: @flattened_later = global [4 x i8] c"\05\01\00\00"
+
+
+; A ConstantExpr shared by two initializers must survive the first one
+; being destroyed.
+
+@shared_target = global [4 x i32] zeroinitializer
+@shared_expr1 = global { i32*, i32 } { i32* getelementptr ([4 x i32], [4 x i32]* @shared_target, i32 0, i32 2), i32 1 }
+; CHECK: @shared_expr1 = global <{ i32, [4 x i8] }> <{ i32 add (i32 ptrtoint ([16 x i8]* @shared_target to i32), i32 8), [4 x i8] c"\01\00\00\00" }>
+@shared_expr2 = global { i32*, i32 } { i32* getelementptr ([4 x i32], [4 x i32]* @shared_target, i32 0, i32 2), i32 2 }
+; CHECK: @shared_expr2 = global <{ i32, [4 x i8] }> <{ i32 add (i32 ptrtoint ([16 x i8]* @shared_target to i32), i32 8), [4 x i8] c"\02\00\00\00" }>
+
+
 ; Special cases
 
 ; Leave vars with "appending" linkage alone.
@@ -207,3 +239,5 @@ define void @func_with_block() {
 label:
   ret void
 }
+
+!0 = !{i32 0, !"normal_form"}
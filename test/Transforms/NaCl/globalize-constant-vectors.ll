@@ -10,6 +10,7 @@
 ; RUN: opt -globalize-constant-vectors %s -S | FileCheck -check-prefix=Cduplicate %s
 ; RUN: opt -globalize-constant-vectors %s -S | FileCheck -check-prefix=Czeroinitializer %s
 ; RUN: opt -expand-constant-expr -globalize-constant-vectors %s -S | FileCheck -check-prefix=Cnestedconst %s
+; RUN: opt -globalize-constant-vectors -globalize-constant-vectors-locals %s -S | FileCheck -check-prefix=Clocal %s
 
 ; Run the test once per function so that each check can look at its
 ; globals as well as its function.
@@ -202,3 +203,25 @@ define i64 @test_nested_const(i64 %x) {
 ; Cnestedconst-NEXT: %[[X1:[_a-z0-9]+]] = bitcast <8 x i8> %[[M1]] to i64
 ; Cnestedconst-NEXT: add i64 %[[X1]], %x
 ; Cnestedconst-NEXT: ret i64 %foo
+
+; With -globalize-constant-vectors-locals, splats and small vectors are rebuilt
+; at function entry, and only large non-splat vectors are globalized.
+define void @testlocal(<4 x float> %in, <8 x float> %wide) {
+  %splat = fadd <4 x float> %in, <float 1.0, float 1.0, float 1.0, float 1.0>
+  %small = fmul <4 x float> %in, <float 1.0, float 2.0, float 3.0, float 4.0>
+  %large = fadd <8 x float> %wide, <float 1.0, float 2.0, float 3.0, float 4.0, float 5.0, float 6.0, float 7.0, float 8.0>
+  ret void
+}
+; Clocal: @[[C1:[_a-z0-9]+]] = internal unnamed_addr constant <8 x float> <float 1.000000e+00, float 2.000000e+00, float 3.000000e+00, float 4.000000e+00, float 5.000000e+00, float 6.000000e+00, float 7.000000e+00, float 8.000000e+00>
+; Clocal: define void @testlocal(<4 x float> %in, <8 x float> %wide) {
+; Clocal-NEXT: %[[S0:[_a-z0-9]+]] = insertelement <4 x float> undef, float 1.000000e+00, i32 0
+; Clocal-NEXT: %[[S1:[_a-z0-9]+]] = shufflevector <4 x float> %[[S0]], <4 x float> undef, <4 x i32> zeroinitializer
+; Clocal-NEXT: %[[V0:[_a-z0-9]+]] = insertelement <4 x float> undef, float 1.000000e+00, i32 0
+; Clocal-NEXT: %[[V1:[_a-z0-9]+]] = insertelement <4 x float> %[[V0]], float 2.000000e+00, i32 1
+; Clocal-NEXT: %[[V2:[_a-z0-9]+]] = insertelement <4 x float> %[[V1]], float 3.000000e+00, i32 2
+; Clocal-NEXT: %[[V3:[_a-z0-9]+]] = insertelement <4 x float> %[[V2]], float 4.000000e+00, i32 3
+; Clocal-NEXT: %[[M1:[_a-z0-9]+]] = load <8 x float>, <8 x float>* @[[C1]]
+; Clocal-NEXT: %splat = fadd <4 x float> %in, %[[S1]]
+; Clocal-NEXT: %small = fmul <4 x float> %in, %[[V3]]
+; Clocal-NEXT: %large = fadd <8 x float> %wide, %[[M1]]
+; Clocal-NEXT: ret void
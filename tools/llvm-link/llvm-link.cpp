@@ -13,8 +13,10 @@
 //===----------------------------------------------------------------------===//
 
 #include "llvm/ADT/STLExtras.h"
+#include "llvm/BinaryFormat/Magic.h"
 #include "llvm/Bitcode/BitcodeReader.h"
 #include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Config/llvm-config.h"
 #include "llvm/IR/AutoUpgrade.h"
 #include "llvm/IR/DiagnosticInfo.h"
 #include "llvm/IR/DiagnosticPrinter.h"
@@ -24,15 +26,21 @@
 #include "llvm/IR/Verifier.h"
 #include "llvm/IRReader/IRReader.h"
 #include "llvm/Linker/Linker.h"
+#include "llvm/Object/Archive.h"
+#include "llvm/Object/IRSymtab.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
 #include "llvm/Support/ManagedStatic.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Path.h"
 #include "llvm/Support/PrettyStackTrace.h"
 #include "llvm/Support/Signals.h"
 #include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/SystemUtils.h"
+#include "llvm/Support/ThreadPool.h"
 #include "llvm/Support/ToolOutputFile.h"
+#include "llvm/Support/VCSRevision.h"
 #include "llvm/Transforms/IPO/FunctionImport.h"
 #include "llvm/Transforms/IPO/Internalize.h"
 #include "llvm/Transforms/Utils/FunctionImportUtils.h"
@@ -87,6 +95,47 @@ static cl::opt<bool>
     DisableLazyLoad("disable-lazy-loading",
                     cl::desc("Disable lazy module loading"));
 
+static cl::opt<unsigned>
+    Threads("threads",
+            cl::desc("Number of threads to read input files on ahead of "
+                     "linking them (0 loads each one as it is linked). Only "
+                     "textual IR is parsed on these threads, so this gives "
+                     "no speedup for bitcode inputs, which are still parsed "
+                     "and linked on the main thread"),
+            cl::init(0));
+
+static cl::opt<bool>
+    TreeLink("tree-link",
+             cl::desc("Link the inputs pairwise in a balanced tree, on "
+                      "-threads threads, instead of one by one into a single "
+                      "module"));
+
+static cl::opt<bool>
+    SummaryDCE("summary-dce",
+               cl::desc("Find the definitions that cannot be reached from "
+                        "the -summary-dce-root symbols using the module "
+                        "summaries of the inputs, and do not link them"));
+
+static cl::list<std::string>
+    SummaryDCERoots("summary-dce-root",
+                    cl::desc("A symbol that -summary-dce keeps, along with "
+                             "all it references (default: main)"),
+                    cl::value_desc("symbol"), cl::CommaSeparated);
+
+static cl::opt<std::string>
+    CacheDir("cache-dir",
+             cl::desc("With -tree-link, keep the result of each pairwise link "
+                      "in this directory, keyed by the fingerprints of the "
+                      "inputs, and reuse it when linking the same inputs "
+                      "again"),
+             cl::value_desc("directory"));
+
+static cl::opt<bool>
+    ArchiveLazy("archive-lazy",
+                cl::desc("Accept archives of bitcode files as inputs, and "
+                         "link in only the members that define a symbol "
+                         "that is still undefined, like a native linker"));
+
 static cl::opt<bool>
     OutputAssembly("S", cl::desc("Write output as LLVM assembly"), cl::Hidden);
 
@@ -115,14 +164,31 @@ static ExitOnError ExitOnErr;
 // Read the specified bitcode file in and return it. This routine searches the
 // link path for the specified file to try to find it...
 //
-static std::unique_ptr<Module> loadFile(const char *argv0,
-                                        const std::string &FN,
-                                        LLVMContext &Context,
-                                        bool MaterializeMetadata = true) {
+// If Buffer is given, it holds the contents of the file, already read by
+// readInputFile.
+static std::unique_ptr<Module>
+loadFile(const char *argv0, const std::string &FN, LLVMContext &Context,
+         bool MaterializeMetadata = true,
+         std::unique_ptr<MemoryBuffer> Buffer = nullptr) {
   SMDiagnostic Err;
   if (Verbose) errs() << "Loading '" << FN << "'\n";
   std::unique_ptr<Module> Result;
-  if (DisableLazyLoad)
+  if (Buffer) {
+    if (DisableLazyLoad)
+      Result = parseIR(Buffer->getMemBufferRef(), Err, Context);
+    else {
+      Expected<std::unique_ptr<Module>> ModuleOrErr =
+          getOwningLazyBitcodeModule(std::move(Buffer), Context,
+                                     !MaterializeMetadata);
+      if (ModuleOrErr)
+        Result = std::move(*ModuleOrErr);
+      else
+        handleAllErrors(ModuleOrErr.takeError(), [&](ErrorInfoBase &EIB) {
+          Err = SMDiagnostic(FN, SourceMgr::DK_Error,
+                             "Invalid bitcode file: " + EIB.message());
+        });
+    }
+  } else if (DisableLazyLoad)
     Result = parseIRFile(FN, Err, Context);
   else
     Result = getLazyIRFileModule(FN, Err, Context, !MaterializeMetadata);
@@ -140,6 +206,56 @@ static std::unique_ptr<Module> loadFile(const char *argv0,
   return Result;
 }
 
+namespace {
+/// An input file read ahead of linking by a worker thread.
+struct InputFile {
+  /// The bitcode of the file, or null if it could not be read.
+  std::unique_ptr<MemoryBuffer> Buffer;
+  /// The diagnostic to print if it could not be read.
+  std::string Error;
+  /// With -cache-dir, a fingerprint of the inputs that went into Buffer.
+  std::string Key;
+};
+} // anonymous namespace
+
+// Read the specified file into Input. This is called on worker threads, so
+// it must not touch the destination context. Bitcode is kept as is, for the
+// main thread to load lazily; textual IR is parsed here, in a context private
+// to this thread, and handed over as bitcode, which is much quicker to read.
+static void readInputFile(const char *argv0, const std::string &FN,
+                          InputFile &Input) {
+  // Bitcode and archives are mapped in place; anything else is returned null
+  // terminated, ready for the assembly parser.
+  ErrorOr<std::unique_ptr<MemoryBuffer>> BufferOrErr = getIRFileOrSTDIN(FN);
+  if (std::error_code EC = BufferOrErr.getError()) {
+    raw_string_ostream OS(Input.Error);
+    SMDiagnostic(FN, SourceMgr::DK_Error,
+                 "Could not open input file: " + EC.message())
+        .print(argv0, OS);
+    return;
+  }
+  std::unique_ptr<MemoryBuffer> Buffer = std::move(*BufferOrErr);
+  StringRef Data = Buffer->getBuffer();
+  if ((Data.size() >= 4 && isBitcode(Data.bytes_begin(), Data.bytes_end())) ||
+      (ArchiveLazy && identify_magic(Data) == file_magic::archive)) {
+    Input.Buffer = std::move(Buffer);
+    return;
+  }
+
+  LLVMContext Context;
+  SMDiagnostic Err;
+  std::unique_ptr<Module> M = parseIR(Buffer->getMemBufferRef(), Err, Context);
+  if (!M) {
+    raw_string_ostream OS(Input.Error);
+    Err.print(argv0, OS);
+    return;
+  }
+  SmallString<0> Bitcode;
+  raw_svector_ostream OS(Bitcode);
+  WriteBitcodeToFile(M.get(), OS, PreserveBitcodeUseListOrder);
+  Input.Buffer = MemoryBuffer::getMemBufferCopy(Bitcode, FN);
+}
+
 namespace {
 
 /// Helper to load on demand a Module from file and cache it for subsequent
@@ -273,20 +389,280 @@ static bool importFunctions(const char *argv0, Module &DestModule) {
   return true;
 }
 
+// Combine the module summaries of Files and mark in it what is reachable from
+// the -summary-dce-root symbols. An input without a summary is taken to need
+// everything it defines or declares; only its global values are read for that.
+static std::unique_ptr<ModuleSummaryIndex>
+computeLiveness(const char *argv0, ArrayRef<std::string> Files) {
+  auto Index = llvm::make_unique<ModuleSummaryIndex>();
+  DenseSet<GlobalValue::GUID> Roots;
+  for (unsigned I = 0; I < Files.size(); ++I) {
+    const std::string &File = Files[I];
+    std::unique_ptr<MemoryBuffer> Buffer = ExitOnErr(errorOrToExpected(
+        MemoryBuffer::getFile(File, /*FileSize=*/-1,
+                              /*RequiresNullTerminator=*/false)));
+    StringRef Data = Buffer->getBuffer();
+    if (Data.size() >= 4 && isBitcode(Data.bytes_begin(), Data.bytes_end()) &&
+        ExitOnErr(getBitcodeLTOInfo(*Buffer)).HasSummary) {
+      ExitOnErr(readModuleSummaryIndex(*Buffer, *Index, I));
+      continue;
+    }
+
+    if (Verbose)
+      errs() << "No summary in '" << File << "', keeping all it uses\n";
+    LLVMContext Context;
+    std::unique_ptr<Module> M = loadFile(argv0, File, Context, false);
+    if (!M)
+      return nullptr;
+    for (const GlobalValue &GV : M->global_values())
+      if (GV.hasName())
+        Roots.insert(GV.getGUID());
+  }
+
+  for (const std::string &Name : SummaryDCERoots)
+    Roots.insert(GlobalValue::getGUID(Name));
+  if (SummaryDCERoots.empty())
+    Roots.insert(GlobalValue::getGUID("main"));
+  // What these reference is used without being named anywhere.
+  for (StringRef Name : {"llvm.used", "llvm.compiler.used", "llvm.global_ctors",
+                         "llvm.global_dtors"})
+    Roots.insert(GlobalValue::getGUID(Name));
+
+  computeDeadSymbols(*Index, Roots);
+  return Index;
+}
+
+// Turn the definitions in M that Index found unreachable into declarations,
+// before their bodies are read. They are then not linked in at all, as
+// nothing live refers to them. Aliasees are kept, since computeDeadSymbols
+// does not follow aliases to them.
+static void dropDeadDefinitions(Module &M, const ModuleSummaryIndex &Index) {
+  SmallPtrSet<const GlobalObject *, 8> Aliasees;
+  for (const GlobalAlias &GA : M.aliases())
+    if (const GlobalObject *GO = GA.getBaseObject())
+      Aliasees.insert(GO);
+  for (const GlobalIFunc &GI : M.ifuncs())
+    if (const GlobalObject *GO = GI.getBaseObject())
+      Aliasees.insert(GO);
+
+  unsigned NumDropped = 0;
+  for (GlobalObject &GO : M.global_objects()) {
+    if (GO.isDeclaration() || GO.hasAppendingLinkage() ||
+        GO.getName().startswith("llvm.") || Aliasees.count(&GO) ||
+        Index.isGUIDLive(GO.getGUID()))
+      continue;
+    if (Function *F = dyn_cast<Function>(&GO))
+      F->deleteBody();
+    else {
+      GlobalVariable &GV = cast<GlobalVariable>(GO);
+      GV.setInitializer(nullptr);
+      GV.setLinkage(GlobalValue::ExternalLinkage);
+    }
+    GO.setComdat(nullptr);
+    ++NumDropped;
+  }
+  if (Verbose && NumDropped)
+    errs() << "Dropping " << NumDropped << " dead definitions from '"
+           << M.getModuleIdentifier() << "'\n";
+}
+
+static bool isArchiveFile(const std::string &FN) {
+  file_magic Magic;
+  return !identify_magic(FN, Magic) && Magic == file_magic::archive;
+}
+
+// Appends the IR names of the global symbols the bitcode in Buffer defines
+// to Defined. They come from its symbol table, or from a lazily loaded module
+// when no symbol table can be had, e.g. for a module without a datalayout.
+// That module is loaded in a context of its own, so that the types and
+// constants it creates do not stay behind in the destination context.
+static Error getDefinedSymbols(MemoryBufferRef Buffer,
+                               std::vector<std::string> &Defined) {
+  Expected<BitcodeFileContents> BFCOrErr = getBitcodeFileContents(Buffer);
+  if (!BFCOrErr)
+    return BFCOrErr.takeError();
+  Expected<irsymtab::FileContents> FCOrErr = irsymtab::readBitcode(*BFCOrErr);
+  if (FCOrErr) {
+    for (const irsymtab::Symbol &Sym : FCOrErr->TheReader.symbols())
+      if (Sym.isGlobal() && !Sym.isUndefined() && !Sym.getIRName().empty())
+        Defined.push_back(Sym.getIRName());
+    return Error::success();
+  }
+  consumeError(FCOrErr.takeError());
+
+  LLVMContext Context;
+  Expected<std::unique_ptr<Module>> MOrErr =
+      getLazyBitcodeModule(Buffer, Context);
+  if (!MOrErr)
+    return MOrErr.takeError();
+  for (const GlobalValue &GV : (*MOrErr)->global_values())
+    if (GV.hasName() && !GV.hasLocalLinkage() && !GV.isDeclaration())
+      Defined.push_back(GV.getName());
+  return Error::success();
+}
+
+// Link in the members of the archive in Buffer that define a symbol Dest
+// only declares, and then the members those need in turn, until nothing
+// changes. Which symbols a member defines is read from its symbol table, so
+// the members that are not needed are never parsed.
+static bool
+linkArchiveLazily(const char *argv0, LLVMContext &Context, Module &Dest,
+                  const std::string &File, MemoryBufferRef Buffer,
+                  function_ref<bool(std::unique_ptr<Module>, StringRef)>
+                      LinkInModule) {
+  std::string Banner = std::string(argv0) + ": " + File + ": ";
+  Expected<std::unique_ptr<object::Archive>> ArchiveOrErr =
+      object::Archive::create(Buffer);
+  if (!ArchiveOrErr) {
+    logAllUnhandledErrors(ArchiveOrErr.takeError(), errs(), Banner);
+    return false;
+  }
+
+  struct Member {
+    std::string Name;
+    MemoryBufferRef Buffer;
+    std::vector<std::string> Defined;
+    bool Linked = false;
+  };
+  std::vector<Member> Members;
+  Error Err = Error::success();
+  // Reports E and gives up on the archive, which leaves Err unchecked.
+  auto Fail = [&](Error E) {
+    logAllUnhandledErrors(std::move(E), errs(), Banner);
+    consumeError(std::move(Err));
+    return false;
+  };
+  for (const object::Archive::Child &C : (*ArchiveOrErr)->children(Err)) {
+    Expected<StringRef> NameOrErr = C.getName();
+    if (!NameOrErr)
+      return Fail(NameOrErr.takeError());
+    Expected<MemoryBufferRef> BufferOrErr = C.getMemoryBufferRef();
+    if (!BufferOrErr)
+      return Fail(BufferOrErr.takeError());
+    // Anything but bitcode, such as a native object, cannot be linked here.
+    if (identify_magic(BufferOrErr->getBuffer()) != file_magic::bitcode)
+      continue;
+
+    Member M;
+    M.Name = (File + "(" + *NameOrErr + ")").str();
+    M.Buffer = *BufferOrErr;
+    if (Error E = getDefinedSymbols(M.Buffer, M.Defined))
+      return Fail(std::move(E));
+    Members.push_back(std::move(M));
+  }
+  if (Err) {
+    logAllUnhandledErrors(std::move(Err), errs(), Banner);
+    return false;
+  }
+
+  auto IsNeeded = [&](StringRef Name) {
+    GlobalValue *GV = Dest.getNamedValue(Name);
+    return GV && GV->isDeclaration();
+  };
+  bool Changed = true;
+  while (Changed) {
+    Changed = false;
+    for (Member &M : Members) {
+      if (M.Linked || none_of(M.Defined, IsNeeded))
+        continue;
+      std::unique_ptr<Module> Mod =
+          loadFile(argv0, M.Name, Context, true,
+                   MemoryBuffer::getMemBuffer(M.Buffer, false));
+      if (!Mod) {
+        errs() << argv0 << ": error loading file '" << M.Name << "'\n";
+        return false;
+      }
+      if (!LinkInModule(std::move(Mod), M.Name))
+        return false;
+      M.Linked = Changed = true;
+    }
+  }
+  return true;
+}
+
 static bool linkFiles(const char *argv0, LLVMContext &Context, Linker &L,
-                      const cl::list<std::string> &Files,
-                      unsigned Flags) {
+                      Module &Dest, const cl::list<std::string> &Files,
+                      unsigned Flags,
+                      const ModuleSummaryIndex *Liveness = nullptr) {
   // Filter out flags that don't apply to the first file we load.
   unsigned ApplicableFlags = Flags & Linker::Flags::OverrideFromSrc;
   // Similar to some flags, internalization doesn't apply to the first file.
   bool InternalizeLinkedSymbols = false;
-  for (const auto &File : Files) {
-    std::unique_ptr<Module> M = loadFile(argv0, File, Context);
+
+  auto LinkInModule = [&](std::unique_ptr<Module> M, StringRef Name) {
+    if (Verbose)
+      errs() << "Linking in '" << Name << "'\n";
+
+    bool Err = false;
+    if (InternalizeLinkedSymbols) {
+      Err = L.linkInModule(
+          std::move(M), ApplicableFlags, [](Module &M, const StringSet<> &GVS) {
+            internalizeModule(M, [&GVS](const GlobalValue &GV) {
+              return !GV.hasName() || (GVS.count(GV.getName()) == 0);
+            });
+          });
+    } else {
+      Err = L.linkInModule(std::move(M), ApplicableFlags);
+    }
+
+    if (Err)
+      return false;
+
+    // Internalization applies to linking of subsequent files.
+    InternalizeLinkedSymbols = Internalize;
+
+    // All linker flags apply to linking of subsequent files.
+    ApplicableFlags = Flags;
+    return true;
+  };
+
+  // With -threads, all the files are read on a thread pool while they are
+  // linked in, in order, on this thread. The pool is declared after the
+  // inputs so that it finishes before they are destroyed.
+  std::vector<InputFile> Inputs(Threads ? Files.size() : 0);
+  std::vector<std::shared_future<void>> InputsRead;
+  std::unique_ptr<ThreadPool> Pool;
+  if (Threads) {
+    Pool = llvm::make_unique<ThreadPool>(Threads);
+    for (unsigned I = 0; I < Files.size(); ++I)
+      InputsRead.push_back(Pool->async(
+          [&, I]() { readInputFile(argv0, Files[I], Inputs[I]); }));
+  }
+
+  for (unsigned I = 0; I < Files.size(); ++I) {
+    const std::string &File = Files[I];
+    std::unique_ptr<MemoryBuffer> Buffer;
+    if (Threads) {
+      InputsRead[I].wait();
+      Buffer = std::move(Inputs[I].Buffer);
+      if (!Buffer)
+        errs() << Inputs[I].Error;
+    } else if (ArchiveLazy && isArchiveFile(File)) {
+      Buffer = ExitOnErr(errorOrToExpected(MemoryBuffer::getFile(
+          File, /*FileSize=*/-1, /*RequiresNullTerminator=*/false)));
+    }
+
+    if (ArchiveLazy && Buffer &&
+        identify_magic(Buffer->getBuffer()) == file_magic::archive) {
+      if (!linkArchiveLazily(argv0, Context, Dest, File,
+                             Buffer->getMemBufferRef(), LinkInModule))
+        return false;
+      continue;
+    }
+
+    std::unique_ptr<Module> M;
+    if (Buffer)
+      M = loadFile(argv0, File, Context, true, std::move(Buffer));
+    else if (!Threads)
+      M = loadFile(argv0, File, Context);
     if (!M.get()) {
       errs() << argv0 << ": error loading file '" << File << "'\n";
       return false;
     }
 
+    if (Liveness)
+      dropDeadDefinitions(*M, *Liveness);
+
     // Note that when ODR merging types cannot verify input files in here When
     // doing that debug metadata in the src module might already be pointing to
     // the destination.
@@ -316,32 +692,163 @@ static bool linkFiles(const char *argv0, LLVMContext &Context, Linker &L,
         return true;
     }
 
-    if (Verbose)
-      errs() << "Linking in '" << File << "'\n";
+    if (!LinkInModule(std::move(M), File))
+      return false;
+  }
 
-    bool Err = false;
-    if (InternalizeLinkedSymbols) {
-      Err = L.linkInModule(
-          std::move(M), ApplicableFlags, [](Module &M, const StringSet<> &GVS) {
-            internalizeModule(M, [&GVS](const GlobalValue &GV) {
-              return !GV.hasName() || (GVS.count(GV.getName()) == 0);
-            });
-          });
-    } else {
-      Err = L.linkInModule(std::move(M), ApplicableFlags);
+  return true;
+}
+
+// Returns the -cache-dir key for the given strings: for an input file, its
+// contents, and for a link, the keys of its inputs.
+static std::string getCacheKey(ArrayRef<StringRef> Parts) {
+  MD5 Hash;
+  // The linker's version is part of every key, as another version may link
+  // or write bitcode differently, and so are the options that change the
+  // output of a link.
+  Hash.update(LLVM_VERSION_STRING);
+#ifdef LLVM_REVISION
+  Hash.update(LLVM_REVISION);
+#endif
+  Hash.update(DisableDITypeMap ? "notypemap" : "typemap");
+  Hash.update(PreserveBitcodeUseListOrder ? "uselistorder" : "");
+  for (StringRef Part : Parts) {
+    Hash.update(Part);
+    Hash.update(StringRef("", 1));
+  }
+  MD5::MD5Result Result;
+  Hash.final(Result);
+  return Result.digest().str();
+}
+
+static std::string getCachePath(const std::string &Key) {
+  SmallString<128> Path(CacheDir);
+  sys::path::append(Path, "llvm-link-" + Key + ".bc");
+  return Path.str();
+}
+
+// Store Bitcode in the cache under Key. It is written to a temporary file
+// and renamed into place, so that concurrent links never see it half
+// written. Failing to write it only costs the next link its reuse.
+static void writeToCache(const std::string &Key, StringRef Bitcode) {
+  SmallString<128> Model(CacheDir);
+  sys::path::append(Model, "llvm-link-%%%%%%%%.tmp");
+  int FD;
+  SmallString<128> TempPath;
+  if (sys::fs::createUniqueFile(Model, FD, TempPath))
+    return;
+  {
+    raw_fd_ostream OS(FD, /*shouldClose=*/true);
+    OS << Bitcode;
+    if (OS.has_error()) {
+      OS.clear_error();
+      sys::fs::remove(TempPath);
+      return;
+    }
+  }
+  if (sys::fs::rename(TempPath, getCachePath(Key)))
+    sys::fs::remove(TempPath);
+}
+
+// Link A and B, in that order, into a new module in a private context, and
+// write the result to Result as bitcode.
+static void linkInputPair(const char *argv0, InputFile &A, InputFile &B,
+                          InputFile &Result) {
+  if (!CacheDir.empty()) {
+    StringRef Keys[] = {A.Key, B.Key};
+    Result.Key = getCacheKey(Keys);
+    ErrorOr<std::unique_ptr<MemoryBuffer>> CachedOrErr = MemoryBuffer::getFile(
+        getCachePath(Result.Key), /*FileSize=*/-1,
+        /*RequiresNullTerminator=*/false);
+    if (CachedOrErr) {
+      if (Verbose)
+        errs() << "Reusing the cached link of '"
+               << A.Buffer->getBufferIdentifier() << "' and '"
+               << B.Buffer->getBufferIdentifier() << "'\n";
+      Result.Buffer = std::move(*CachedOrErr);
+      return;
     }
+  }
 
-    if (Err)
-      return false;
+  LLVMContext Context;
+  Context.setDiagnosticHandler(llvm::make_unique<LLVMLinkDiagnosticHandler>(),
+                               true);
+  if (!DisableDITypeMap)
+    Context.enableDebugTypeODRUniquing();
 
-    // Internalization applies to linking of subsequent files.
-    InternalizeLinkedSymbols = Internalize;
+  Module Dest("llvm-link", Context);
+  Linker L(Dest);
+  for (InputFile *Input : {&A, &B}) {
+    std::string Name = Input->Buffer->getBufferIdentifier();
+    std::unique_ptr<Module> M =
+        loadFile(argv0, Name, Context, true, std::move(Input->Buffer));
+    if (!M || L.linkInModule(std::move(M))) {
+      Result.Error = std::string(argv0) + ": error linking '" + Name + "'\n";
+      return;
+    }
+  }
 
-    // All linker flags apply to linking of subsequent files.
-    ApplicableFlags = Flags;
+  SmallString<0> Bitcode;
+  raw_svector_ostream OS(Bitcode);
+  WriteBitcodeToFile(&Dest, OS, PreserveBitcodeUseListOrder);
+  if (!CacheDir.empty())
+    writeToCache(Result.Key, Bitcode);
+  Result.Buffer = MemoryBuffer::getMemBufferCopy(Bitcode, "llvm-link");
+}
+
+// Link Files as a balanced tree: neighbouring inputs are linked pairwise, in
+// parallel, then neighbouring results, and so on, with the last one linked
+// into L. Each link is then against a module of the size of its subtree
+// rather than against everything linked so far, at the price of writing and
+// reading every level as bitcode. Merging neighbours keeps the command-line
+// order, so symbol resolution is the same as linking one by one.
+//
+// With -cache-dir, every link in the tree is cached under a key made from
+// the contents of the inputs under it. When a single input changes, only the
+// links on its path to the root are redone.
+static bool linkFilesAsTree(const char *argv0, LLVMContext &Context, Linker &L,
+                            const cl::list<std::string> &Files) {
+  std::vector<InputFile> Level(Files.size());
+  ThreadPool Pool(Threads ? Threads : llvm::heavyweight_hardware_concurrency());
+  for (unsigned I = 0; I < Files.size(); ++I)
+    Pool.async([&, I]() {
+      readInputFile(argv0, Files[I], Level[I]);
+      if (!CacheDir.empty() && Level[I].Buffer)
+        Level[I].Key = getCacheKey(Level[I].Buffer->getBuffer());
+    });
+  Pool.wait();
+
+  while (true) {
+    bool Failed = false;
+    for (unsigned I = 0; I < Level.size(); ++I) {
+      if (!Level[I].Buffer) {
+        errs() << Level[I].Error;
+        Failed = true;
+      }
+    }
+    if (Failed)
+      return false;
+    if (Level.size() == 1)
+      break;
+
+    std::vector<InputFile> Next((Level.size() + 1) / 2);
+    for (unsigned I = 0; I < Next.size(); ++I) {
+      if (2 * I + 1 < Level.size())
+        Pool.async([&, I]() {
+          linkInputPair(argv0, Level[2 * I], Level[2 * I + 1], Next[I]);
+        });
+      else
+        Next[I] = std::move(Level[2 * I]);
+    }
+    Pool.wait();
+    Level = std::move(Next);
   }
 
-  return true;
+  if (Verbose)
+    errs() << "Linking in the merged inputs\n";
+  std::unique_ptr<Module> M =
+      loadFile(argv0, "llvm-link", Context, true, std::move(Level[0].Buffer));
+  return M && !L.linkInModule(std::move(M));
 }
 
 int main(int argc, char **argv) {
@@ -367,13 +874,60 @@ int main(int argc, char **argv) {
   if (OnlyNeeded)
     Flags |= Linker::Flags::LinkOnlyNeeded;
 
+  if (TreeLink && (OnlyNeeded || Internalize || !SummaryIndex.empty())) {
+    // What is needed, or may be internalized, depends on all the modules
+    // linked so far, which the subtrees do not see.
+    errs() << argv[0] << ": -tree-link cannot be used with -only-needed, "
+                         "-internalize or -summary-index\n";
+    return 1;
+  }
+
+  if (!CacheDir.empty()) {
+    if (!TreeLink) {
+      errs() << argv[0] << ": -cache-dir can only be used with -tree-link\n";
+      return 1;
+    }
+    if (std::error_code EC = sys::fs::create_directories(CacheDir)) {
+      errs() << argv[0] << ": cannot create cache directory '" << CacheDir
+             << "': " << EC.message() << '\n';
+      return 1;
+    }
+  }
+
+  if (SummaryDCE && (TreeLink || ArchiveLazy)) {
+    errs() << argv[0] << ": -summary-dce cannot be used with -tree-link or "
+                         "-archive-lazy\n";
+    return 1;
+  }
+
+  std::unique_ptr<ModuleSummaryIndex> Liveness;
+  if (SummaryDCE) {
+    std::vector<std::string> AllInputs(InputFilenames.begin(),
+                                       InputFilenames.end());
+    AllInputs.insert(AllInputs.end(), OverridingInputs.begin(),
+                     OverridingInputs.end());
+    Liveness = computeLiveness(argv[0], AllInputs);
+    if (!Liveness)
+      return 1;
+  }
+
+  if (ArchiveLazy && (TreeLink || !SummaryIndex.empty())) {
+    errs() << argv[0] << ": -archive-lazy cannot be used with -tree-link or "
+                         "-summary-index\n";
+    return 1;
+  }
+
   // First add all the regular input files
-  if (!linkFiles(argv[0], Context, L, InputFilenames, Flags))
+  if (TreeLink) {
+    if (!linkFilesAsTree(argv[0], Context, L, InputFilenames))
+      return 1;
+  } else if (!linkFiles(argv[0], Context, L, *Composite, InputFilenames,
+                        Flags, Liveness.get()))
     return 1;
 
   // Next the -override ones.
-  if (!linkFiles(argv[0], Context, L, OverridingInputs,
-                 Flags | Linker::Flags::OverrideFromSrc))
+  if (!linkFiles(argv[0], Context, L, *Composite, OverridingInputs,
+                 Flags | Linker::Flags::OverrideFromSrc, Liveness.get()))
     return 1;
 
   // Import any functions requested via -import
@@ -18,6 +18,8 @@
 
 #include "llvm/ADT/StringSwitch.h"
 #include "llvm/BinaryFormat/COFF.h"
+#include "llvm/BinaryFormat/Magic.h"
+#include "llvm/Bitcode/BitcodeReader.h"
 #include "llvm/Demangle/Demangle.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/LLVMContext.h"
@@ -26,6 +28,7 @@
 #include "llvm/Object/COFFImportFile.h"
 #include "llvm/Object/ELFObjectFile.h"
 #include "llvm/Object/IRObjectFile.h"
+#include "llvm/Object/IRSymtab.h"
 #include "llvm/Object/MachO.h"
 #include "llvm/Object/MachOUniversal.h"
 #include "llvm/Object/ObjectFile.h"
@@ -40,6 +43,7 @@
 #include "llvm/Support/Signals.h"
 #include "llvm/Support/TargetSelect.h"
 #include "llvm/Support/raw_ostream.h"
+#include <cstdio>
 #include <vector>
 
 using namespace llvm;
@@ -179,6 +183,11 @@ cl::opt<bool> DyldInfoOnly("dyldinfo-only",
 cl::opt<bool> NoLLVMBitcode("no-llvm-bc",
                             cl::desc("Disable LLVM bitcode reader"));
 
+cl::opt<bool> Batch("batch",
+                    cl::desc("Read bitcode files and archives to dump, one "
+                             "per line, from standard input, and print the "
+                             "symbol table of each as soon as it is read"));
+
 bool PrintAddress = true;
 
 bool MultipleFiles = false;
@@ -1914,6 +1923,106 @@ static void dumpSymbolNamesFromFile(std::string &Filename) {
   }
 }
 
+// Returns the nm type character of a symbol in a bitcode symbol table. These
+// match what is printed for the same symbol read through IRObjectFile.
+static char getIRSymtabTypeChar(const irsymtab::Symbol &Sym) {
+  if (Sym.isWeak())
+    return Sym.isUndefined() ? 'w' : 'W';
+  if (Sym.isUndefined())
+    return 'U';
+  if (Sym.isCommon())
+    return 'C';
+  char Ret = Sym.isExecutable() ? 't' : 'd';
+  return Sym.isGlobal() ? toupper(Ret) : Ret;
+}
+
+// Print the symbol table of a bitcode file, straight from the irsymtab it
+// carries, so no IR is parsed unless the file predates irsymtab.
+static void dumpIRSymtab(MemoryBufferRef Buffer, StringRef Name) {
+  Expected<BitcodeFileContents> BFCOrErr = getBitcodeFileContents(Buffer);
+  if (!BFCOrErr) {
+    error(BFCOrErr.takeError(), Name);
+    return;
+  }
+  Expected<irsymtab::FileContents> FCOrErr = irsymtab::readBitcode(*BFCOrErr);
+  if (!FCOrErr) {
+    error(FCOrErr.takeError(), Name);
+    return;
+  }
+  outs() << Name << ":\n";
+  for (const irsymtab::Symbol &Sym : FCOrErr->TheReader.symbols()) {
+    if (Sym.isFormatSpecific())
+      continue;
+    char TypeChar = getIRSymtabTypeChar(Sym);
+    if ((UndefinedOnly && TypeChar != 'U' && TypeChar != 'w') ||
+        (DefinedOnly && (TypeChar == 'U' || TypeChar == 'w')) ||
+        (ExternalOnly && !Sym.isGlobal() && !Sym.isUndefined()))
+      continue;
+    outs() << TypeChar << ' ' << Sym.getName() << '\n';
+  }
+}
+
+// Dump a bitcode file, or every bitcode member of an archive, for -batch.
+// Each symbol table is printed as its name followed by a colon, then one
+// symbol per line as its type character and name.
+static void dumpBatchFile(StringRef Filename) {
+  ErrorOr<std::unique_ptr<MemoryBuffer>> BufferOrErr =
+      MemoryBuffer::getFile(Filename);
+  if (error(BufferOrErr.getError(), Filename))
+    return;
+  MemoryBufferRef Buffer = BufferOrErr.get()->getMemBufferRef();
+
+  if (identify_magic(Buffer.getBuffer()) != file_magic::archive) {
+    if (identify_magic(Buffer.getBuffer()) != file_magic::bitcode) {
+      error("not an LLVM bitcode file or archive", Filename);
+      return;
+    }
+    dumpIRSymtab(Buffer, Filename);
+    return;
+  }
+
+  Expected<std::unique_ptr<Archive>> AOrErr = Archive::create(Buffer);
+  if (!AOrErr) {
+    error(AOrErr.takeError(), Filename);
+    return;
+  }
+  Error Err = Error::success();
+  for (auto &C : (*AOrErr)->children(Err)) {
+    Expected<MemoryBufferRef> MemberOrErr = C.getMemoryBufferRef();
+    if (!MemberOrErr) {
+      error(MemberOrErr.takeError(), Filename, C);
+      continue;
+    }
+    if (identify_magic(MemberOrErr->getBuffer()) != file_magic::bitcode)
+      continue;
+    dumpIRSymtab(*MemberOrErr,
+                 (Filename + "(" + MemberOrErr->getBufferIdentifier() + ")")
+                     .str());
+  }
+  if (Err)
+    error(std::move(Err), Filename);
+}
+
+// Serve -batch requests until standard input is closed. The output for each
+// file ends with an empty line, even if it could not be read, and is flushed,
+// so a client may keep this process around and send it files one at a time.
+static void dumpBatchFiles() {
+  std::string Line;
+  int C = 0;
+  while (C != EOF) {
+    Line.clear();
+    while ((C = getchar()) != EOF && C != '\n')
+      Line += C;
+    if (!Line.empty() && Line.back() == '\r')
+      Line.pop_back();
+    if (Line.empty())
+      continue;
+    dumpBatchFile(Line);
+    outs() << '\n';
+    outs().flush();
+  }
+}
+
 int main(int argc, char **argv) {
   // Print a stack trace if we signal out.
   sys::PrintStackTraceOnErrorSignal(argv[0]);
@@ -1946,7 +2055,7 @@ int main(int argc, char **argv) {
     PrintAddress = false;
   if (OutputFormat == sysv || SizeSort)
     PrintSize = true;
-  if (InputFilenames.empty())
+  if (InputFilenames.empty() && !Batch)
     InputFilenames.push_back("a.out");
   if (InputFilenames.size() > 1)
     MultipleFiles = true;
@@ -1968,7 +2077,10 @@ int main(int argc, char **argv) {
   if (NoDyldInfo && (AddDyldInfo || DyldInfoOnly))
     error("-no-dyldinfo can't be used with -add-dyldinfo or -dyldinfo-only");
 
-  llvm::for_each(InputFilenames, dumpSymbolNamesFromFile);
+  if (Batch)
+    dumpBatchFiles();
+  else
+    llvm::for_each(InputFilenames, dumpSymbolNamesFromFile);
 
   if (HadError)
     return 1;